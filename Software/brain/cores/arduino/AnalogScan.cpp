@@ -0,0 +1,280 @@
+/*
+  AnalogScan.cpp - Background ADC scanning of a list of channels.
+  See AnalogScan.h for how to use it.
+*/
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "AnalogScan.h"
+
+AnalogScanner AnalogScan;
+
+ISR(ADC_vect) {
+  AnalogScan.convert();
+}
+
+AnalogScanner::AnalogScanner() {
+  _count = 0;
+  _back = 0;
+  _index = 0;
+  _taken = 0;
+  _sum = 0;
+  _running = false;
+  _available = false;
+  _scans = 0;
+  _callback = 0;
+  _trigger = ANALOG_TRIGGER_NONE;
+  _fifo_head = 0;
+  _fifo_count = 0;
+  _fifo_overruns = 0;
+  resetJitter();
+}
+
+// log2 of a power of two from 1 to 64, or 0xFF
+static uint8_t oversampleShift(uint8_t samples) {
+  for (uint8_t shift = 0; shift <= 6; shift++)
+    if (samples == (1 << shift))
+      return shift;
+  return 0xFF;
+}
+
+int AnalogScanner::begin(const uint8_t *channels, uint8_t count, uint8_t oversample) {
+  uint8_t shift = oversampleShift(oversample);
+  if (count == 0 || count > ANALOG_SCAN_CHANNELS || shift == 0xFF)
+    return 1;
+  stop();
+  for (uint8_t i = 0; i < count; i++) {
+    _channels[i] = channels[i] & 0x07;
+    _shift[i] = shift;
+    _results[0][i] = 0;
+    _results[1][i] = 0;
+  }
+  _count = count;
+  _scans = 0;
+  _available = false;
+  return 0;
+}
+
+int AnalogScanner::oversample(uint8_t index, uint8_t samples) {
+  uint8_t shift = oversampleShift(samples);
+  if (index >= _count || shift == 0xFF)
+    return 1;
+  uint8_t oldSREG = SREG;
+  cli();
+  _shift[index] = shift;
+  SREG = oldSREG;
+  return 0;
+}
+
+void AnalogScanner::attach(AnalogScanCallback callback) {
+  _callback = callback;
+}
+
+void AnalogScanner::detach() {
+  _callback = 0;
+}
+
+// Points the multiplexer at the current channel
+void AnalogScanner::select() {
+  ADMUX = (analog_reference << 6) | _channels[_index];
+}
+
+int AnalogScanner::trigger(uint8_t source) {
+  if (source != ANALOG_TRIGGER_NONE &&
+      (source < ANALOG_TRIGGER_TIMER0_COMPA || source > ANALOG_TRIGGER_TIMER1_CAPTURE))
+    return 1;
+  _trigger = source;
+  return 0;
+}
+
+int AnalogScanner::syncToPwm(uint8_t pin) {
+  switch (digitalPinToTimer(pin)) {
+    case TIMER1A:
+    case TIMER1B:
+      return trigger(ANALOG_TRIGGER_TIMER1_OVERFLOW);
+  }
+  return 1;
+}
+
+void AnalogScanner::start() {
+  if (!_count || _running)
+    return;
+  _index = 0;
+  _taken = 0;
+  _sum = 0;
+  select();
+  _running = true;
+  if (_trigger == ANALOG_TRIGGER_NONE) {
+    // Clear any stale completion flag, then enable the interrupt and start
+    ADCSRA |= _BV(ADIF) | _BV(ADIE) | _BV(ADSC);
+  } else {
+    // The ADC starts on the rising edge of the timer flag, so clear a
+    // stale one first
+    clearTrigger();
+    ADCSRB = (ADCSRB & ~0x07) | _trigger;
+    ADCSRA |= _BV(ADIF) | _BV(ADIE) | _BV(ADATE);
+  }
+}
+
+void AnalogScanner::stop() {
+  _running = false;
+  // Stop triggering, let a conversion in progress finish, then leave the
+  // ADC as analogRead() expects it
+  ADCSRA &= ~_BV(ADATE);
+  ADCSRB &= ~0x07;
+  while (ADCSRA & _BV(ADSC))
+    ;
+  ADCSRA = (ADCSRA & ~_BV(ADIE)) | _BV(ADIF);
+}
+
+boolean AnalogScanner::available() {
+  return _available;
+}
+
+unsigned int AnalogScanner::read(uint8_t index) {
+  if (index >= _count)
+    return 0;
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int result = _results[_back ^ 1][index];
+  SREG = oldSREG;
+  return result;
+}
+
+void AnalogScanner::copy(unsigned int *results) {
+  uint8_t oldSREG = SREG;
+  cli();
+  // With interrupts off so the halves can't swap part way through
+  memcpy(results, _results[_back ^ 1], _count * sizeof(unsigned int));
+  _available = false;
+  SREG = oldSREG;
+}
+
+unsigned long AnalogScanner::scans() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long scans = _scans;
+  SREG = oldSREG;
+  return scans;
+}
+
+boolean AnalogScanner::readSample(unsigned int *value, uint8_t *index) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!_fifo_count) {
+    SREG = oldSREG;
+    return false;
+  }
+  unsigned int sample = _fifo[_fifo_head];
+  _fifo_head = (_fifo_head + 1) % ANALOG_SAMPLE_BUFFER;
+  _fifo_count--;
+  SREG = oldSREG;
+
+  *value = sample & 0x0FFF;
+  if (index)
+    *index = sample >> 12;
+  return true;
+}
+
+unsigned int AnalogScanner::sampleOverruns() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int overruns = _fifo_overruns;
+  SREG = oldSREG;
+  return overruns;
+}
+
+unsigned int AnalogScanner::jitter() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int spread = _latency_max >= _latency_min ? _latency_max - _latency_min : 0;
+  SREG = oldSREG;
+  // Timer0 always runs at clk/64, Timer1 at whatever pwm16Begin() chose
+  static const unsigned int prescales[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  uint8_t cs = (_trigger == ANALOG_TRIGGER_TIMER0_COMPA ||
+                _trigger == ANALOG_TRIGGER_TIMER0_OVERFLOW ? TCCR0B : TCCR1B) & 0x07;
+  unsigned long cycles = (unsigned long) spread * prescales[cs];
+  return cycles > 0xFFFF ? 0xFFFF : cycles;
+}
+
+void AnalogScanner::resetJitter() {
+  uint8_t oldSREG = SREG;
+  cli();
+  _latency_min = 0xFFFF;
+  _latency_max = 0;
+  SREG = oldSREG;
+}
+
+// Timer counts since the trigger event, read at the start of the ADC
+// interrupt
+unsigned int AnalogScanner::triggerCount() {
+  switch (_trigger) {
+    case ANALOG_TRIGGER_TIMER0_OVERFLOW:
+      return TCNT0;
+    case ANALOG_TRIGGER_TIMER0_COMPA:
+      return (uint8_t) (TCNT0 - OCR0A);
+    case ANALOG_TRIGGER_TIMER1_COMPB:
+      return TCNT1 - OCR1B;
+    case ANALOG_TRIGGER_TIMER1_CAPTURE:
+      return TCNT1 - ICR1;
+  }
+  // Overflow at BOTTOM, counting up again by the time the ADC is done.
+  // In fast PWM it comes at TOP, and the count has restarted from 0.
+  return TCNT1;
+}
+
+/* Clears the flag of a trigger that has no ISR of its own, since the next
+   conversion needs a fresh rising edge.  Timer0 overflow is cleared by the
+   millis interrupt, and input capture is left to whoever handles it. */
+void AnalogScanner::clearTrigger() {
+  if (_trigger == ANALOG_TRIGGER_TIMER0_COMPA)
+    TIFR0 = _BV(OCF0A);
+  else if (_trigger == ANALOG_TRIGGER_TIMER1_OVERFLOW)
+    TIFR1 = _BV(TOV1);
+  else if (_trigger == ANALOG_TRIGGER_TIMER1_COMPB)
+    TIFR1 = _BV(OCF1B);
+}
+
+/* Takes the finished conversion, moves on to the next sample, channel or
+   scan, and starts the next conversion. */
+void AnalogScanner::convert() {
+  if (!_running)
+    return;
+
+  boolean triggered = _trigger != ANALOG_TRIGGER_NONE;
+  if (triggered) {
+    unsigned int latency = triggerCount();
+    if (latency < _latency_min)
+      _latency_min = latency;
+    if (latency > _latency_max)
+      _latency_max = latency;
+    clearTrigger();
+  }
+
+  _sum += ADC;
+  if (++_taken == (1 << _shift[_index])) {
+    unsigned int result = _sum >> _shift[_index];
+    _results[_back][_index] = result;
+    if (triggered) {
+      if (_fifo_count == ANALOG_SAMPLE_BUFFER) {
+        _fifo_overruns++;
+      } else {
+        _fifo[(_fifo_head + _fifo_count) % ANALOG_SAMPLE_BUFFER] =
+            result | ((unsigned int) _index << 12);
+        _fifo_count++;
+      }
+    }
+    _sum = 0;
+    _taken = 0;
+    if (++_index == _count) {
+      _index = 0;
+      _back ^= 1;
+      _scans++;
+      _available = true;
+      if (_callback)
+        _callback();
+    }
+    select();
+  }
+  if (!triggered)
+    ADCSRA |= _BV(ADSC);
+}
@@ -0,0 +1,143 @@
+/*
+  AnalogScan.h - Background ADC scanning of a list of channels.
+
+  analogRead() waits out each conversion, about 85 us at 20 MHz, so reading
+  eight channels costs the loop most of a millisecond.  AnalogScan instead
+  runs the conversions from the ADC complete interrupt: each one starts the
+  next, stepping through the channel list, and the CPU is only busy for the
+  few microseconds the interrupt takes.
+
+  Each channel can be oversampled: 1, 2, 4 ... 64 conversions are summed
+  and averaged into one 10-bit result.  Results go into the back half of a
+  double buffer; when the last channel is done the halves swap, so read()
+  and copy() always see one complete, consistent scan, and the callback
+  (if attached) runs from the interrupt.
+
+    const uint8_t cells[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    AnalogScan.begin(cells, 8, 4);   // each cell averaged over 4 samples
+    AnalogScan.start();
+    ...
+    if (AnalogScan.available()) {
+      unsigned int v[8];
+      AnalogScan.copy(v);
+    }
+
+  By default each conversion is started by the interrupt of the one
+  before.  syncToPwm() or trigger() hand the start over to a timer event
+  instead (ADC auto-trigger), so every conversion happens at the same point
+  in the PWM period, with no CPU involved in the timing.  For the Timer1
+  pins (12 and 13), which init() sets up for phase correct PWM, the event
+  is the overflow at BOTTOM: the middle of the on-time, where the average
+  current in a switched load is, and as far as possible from the edges.
+  Timer2 has no ADC trigger, so pins 14 and 15 can't be synchronised.
+
+  In triggered mode each result, after oversampling, is also put in a
+  small FIFO for readSample(), so a stream of per-period samples can be
+  processed without missing any.  jitter() is the spread, in cpu cycles,
+  of the time from the timer event to the ADC interrupt.  That includes
+  interrupt latency, so it is an upper bound on the sampling jitter, which
+  the hardware holds to one ADC clock (128 cycles).
+
+    analogWrite(13, 100);
+    AnalogScan.begin(current_channel, 1);
+    AnalogScan.syncToPwm(13);
+    AnalogScan.start();
+    ...
+    unsigned int amps;
+    while (AnalogScan.readSample(&amps))
+      filter(amps);
+
+  analogRead() must not be used while a scan is running.
+*/
+#ifndef AnalogScan_h
+#define AnalogScan_h
+
+#include <inttypes.h>
+
+#define ANALOG_SCAN_CHANNELS 8
+#define ANALOG_SAMPLE_BUFFER 16
+
+// Auto-trigger sources, the ADTS values for ADCSRB
+#define ANALOG_TRIGGER_NONE 0xFF
+#define ANALOG_TRIGGER_TIMER0_COMPA 3
+#define ANALOG_TRIGGER_TIMER0_OVERFLOW 4
+#define ANALOG_TRIGGER_TIMER1_COMPB 5
+#define ANALOG_TRIGGER_TIMER1_OVERFLOW 6
+#define ANALOG_TRIGGER_TIMER1_CAPTURE 7
+
+typedef void (*AnalogScanCallback)(void);
+
+class AnalogScanner
+{
+  public:
+    AnalogScanner();
+    // Sets the channels to scan (0-7, as for analogRead()), in order, and
+    // the oversampling for all of them.  Stops a running scan.  Returns 1
+    // for too many channels or an oversample that isn't a power of two up
+    // to 64.
+    int begin(const uint8_t *channels, uint8_t count, uint8_t oversample = 1);
+    // Changes the oversampling for one entry of the channel list
+    int oversample(uint8_t index, uint8_t samples);
+    // Called from the interrupt each time a full scan is ready
+    void attach(AnalogScanCallback callback);
+    void detach();
+    // Starts each conversion on a timer event, one of ANALOG_TRIGGER_*.
+    // ANALOG_TRIGGER_NONE goes back to back conversions.  Takes
+    // effect at the next start().  Returns 1 for an unknown source.
+    int trigger(uint8_t source);
+    // Triggers on the event that lines up with the PWM analogWrite() puts
+    // on pin, 12 or 13.  Returns 1 for any other pin: Timer0 is the
+    // millis() tick, and its pins are the MCP2515 INT and chip select.
+    int syncToPwm(uint8_t pin);
+    // Scans continuously until stop()
+    void start();
+    void stop();
+    // True if a scan has completed since the last copy()
+    boolean available();
+    // Result for entry index of the channel list, from the last full scan
+    unsigned int read(uint8_t index);
+    // Copies the whole last scan, one result per channel in list order
+    void copy(unsigned int *results);
+    // Scans completed since begin()
+    unsigned long scans();
+    // In triggered mode, takes the oldest result from the FIFO.  Returns
+    // false if it is empty.  index, if given, gets the channel list entry.
+    boolean readSample(unsigned int *value, uint8_t *index = 0);
+    // Results lost because the FIFO was full
+    unsigned int sampleOverruns();
+    // Spread of trigger to interrupt times since the last resetJitter(),
+    // in cpu cycles (at the trigger timer's resolution), up to 65535
+    unsigned int jitter();
+    void resetJitter();
+    // Called from the ADC interrupt
+    void convert();
+  private:
+    void select();
+    unsigned int triggerCount();
+    void clearTrigger();
+    uint8_t _channels[ANALOG_SCAN_CHANNELS];
+    uint8_t _shift[ANALOG_SCAN_CHANNELS];
+    uint8_t _count;
+    unsigned int _results[2][ANALOG_SCAN_CHANNELS];
+    // half of _results being filled; the other one is complete
+    uint8_t _back;
+    uint8_t _index;
+    uint8_t _taken;
+    unsigned int _sum;
+    volatile boolean _running;
+    volatile boolean _available;
+    volatile unsigned long _scans;
+    AnalogScanCallback _callback;
+    uint8_t _trigger;
+    // result, with the list entry in the top four bits
+    unsigned int _fifo[ANALOG_SAMPLE_BUFFER];
+    uint8_t _fifo_head;
+    volatile uint8_t _fifo_count;
+    volatile unsigned int _fifo_overruns;
+    unsigned int _latency_min;
+    unsigned int _latency_max;
+};
+
+extern AnalogScanner AnalogScan;
+
+#endif
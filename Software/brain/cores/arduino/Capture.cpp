@@ -0,0 +1,220 @@
+/*
+  Capture.cpp - Timer1 input capture measurement.
+  See Capture.h for how to use it.
+*/
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "Capture.h"
+
+InputCapture Capture;
+
+ISR(TIMER1_CAPT_vect) {
+  Capture.capture();
+}
+
+ISR(TIMER1_OVF_vect) {
+  Capture.overflow();
+}
+
+InputCapture::InputCapture() {
+  _prescale = 0;
+  _edges = CAPTURE_BOTH;
+  _overflows = 0;
+  _last_rise = 0;
+  _last_edge = 0;
+  _period = 0;
+  _high = 0;
+  _count = 0;
+  _head = 0;
+  _filled = 0;
+}
+
+int InputCapture::begin(unsigned int prescale, uint8_t edges, boolean filter) {
+  uint8_t cs;
+  switch (prescale) {
+    case 1: cs = _BV(CS10); break;
+    case 8: cs = _BV(CS11); break;
+    case 64: cs = _BV(CS11) | _BV(CS10); break;
+    case 256: cs = _BV(CS12); break;
+    case 1024: cs = _BV(CS12) | _BV(CS10); break;
+    default: return 1;
+  }
+
+  pinMode(14, INPUT);
+  uint8_t oldSREG = SREG;
+  cli();
+  _prescale = prescale;
+  _edges = edges;
+  _overflows = 0;
+  _last_rise = 0;
+  _last_edge = 0;
+  _period = 0;
+  _high = 0;
+  _count = 0;
+  _head = 0;
+  _filled = 0;
+  // Normal mode, counting 0 to 0xFFFF, outputs disconnected
+  TCCR1B = 0;
+  TCCR1A = 0;
+  TCNT1 = 0;
+  // Start on a rising edge
+  TCCR1B = _BV(ICES1) | (filter ? _BV(ICNC1) : 0) | cs;
+  TIFR1 = _BV(ICF1) | _BV(TOV1);
+  TIMSK1 = _BV(ICIE1) | _BV(TOIE1);
+  SREG = oldSREG;
+  return 0;
+}
+
+void InputCapture::end() {
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK1 &= ~(_BV(ICIE1) | _BV(TOIE1));
+  _prescale = 0;
+  SREG = oldSREG;
+  pwm16End();
+}
+
+/* The 32-bit time of a 16-bit count read in one of the interrupts, or with
+   interrupts off.  An overflow still pending belongs to the count if the
+   count is small, i.e. it wrapped before the count was taken. */
+unsigned long InputCapture::timestamp(unsigned int count) {
+  unsigned int overflows = _overflows;
+  if ((TIFR1 & _BV(TOV1)) && count < 0x8000)
+    overflows++;
+  return ((unsigned long) overflows << 16) | count;
+}
+
+unsigned long InputCapture::now() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long t = timestamp(TCNT1);
+  SREG = oldSREG;
+  return t;
+}
+
+void InputCapture::overflow() {
+  _overflows++;
+}
+
+void InputCapture::capture() {
+  // Read the latched count first; the edge that caused it is the one
+  // ICES1 was set for
+  unsigned int count = ICR1;
+  boolean rising = TCCR1B & _BV(ICES1);
+  unsigned long t = timestamp(count);
+
+  if (_edges == CAPTURE_BOTH) {
+    // Flip the edge; the flag must be cleared after changing ICES1
+    TCCR1B ^= _BV(ICES1);
+    TIFR1 = _BV(ICF1);
+  }
+
+  if (rising) {
+    if (_count) {
+      unsigned long period = t - _last_rise;
+      _period = period;
+      // In CAPTURE_BOTH the edge before this one was the fall
+      if (_edges == CAPTURE_BOTH)
+        _high = _last_edge - _last_rise;
+      _history[_head] = period;
+      _head = (_head + 1) % CAPTURE_HISTORY;
+      if (_filled < CAPTURE_HISTORY)
+        _filled++;
+    }
+    _last_rise = t;
+  }
+  _last_edge = t;
+  _count++;
+}
+
+unsigned long InputCapture::period() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long period = _period;
+  SREG = oldSREG;
+  return period;
+}
+
+unsigned long InputCapture::highTime() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long high = _high;
+  SREG = oldSREG;
+  return high;
+}
+
+unsigned int InputCapture::duty() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long period = _period;
+  unsigned long high = _high;
+  SREG = oldSREG;
+  if (!period)
+    return 0;
+  // Scale both down so high * 65535 fits in 32 bits
+  while (period > 0xFFFF) {
+    period >>= 1;
+    high >>= 1;
+  }
+  if (high >= period)
+    return 0xFFFF;
+  return (high * 0xFFFF) / period;
+}
+
+unsigned long InputCapture::averagePeriod() {
+  unsigned long history[CAPTURE_HISTORY];
+  uint8_t n = this->history(history, CAPTURE_HISTORY);
+  if (!n)
+    return 0;
+  // Divide as we go so that eight long periods can't overflow the sum
+  unsigned long mean = 0;
+  unsigned long rest = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    mean += history[i] / n;
+    rest += history[i] % n;
+  }
+  return mean + rest / n;
+}
+
+float InputCapture::frequency() {
+  unsigned long p = period();
+  if (!p)
+    return 0;
+  return (float) F_CPU / (_prescale ? _prescale : 1) / p;
+}
+
+unsigned long InputCapture::sinceEdge() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long t = timestamp(TCNT1) - _last_edge;
+  SREG = oldSREG;
+  return t;
+}
+
+uint8_t InputCapture::history(unsigned long *periods, uint8_t max) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t n = _filled < max ? _filled : max;
+  uint8_t i = _head;
+  for (uint8_t k = 0; k < n; k++) {
+    i = (i + CAPTURE_HISTORY - 1) % CAPTURE_HISTORY;
+    periods[k] = _history[i];
+  }
+  SREG = oldSREG;
+  return n;
+}
+
+unsigned long InputCapture::edges() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long count = _count;
+  SREG = oldSREG;
+  return count;
+}
+
+unsigned long InputCapture::ticksToMicros(unsigned long ticks) {
+  // ticks * prescale cycles, split so it can't overflow for long periods
+  const unsigned long cycles_per_us = clockCyclesPerMicrosecond();
+  return ticks / cycles_per_us * _prescale +
+         ticks % cycles_per_us * _prescale / cycles_per_us;
+}
@@ -0,0 +1,93 @@
+/*
+  Capture.h - Period, frequency and duty measurement with Timer1 input
+  capture.
+
+  pulseIn() times a pulse by counting trips round a loop, so it blocks for
+  up to its timeout and any interrupt on the way stretches the result.
+  Capture instead lets the Timer1 input capture unit latch the timer on
+  each edge of the ICP1 pin (pin 14, PD6) in hardware.  The interrupt only
+  has to store the count, so the timing is exact to one timer tick however
+  late the interrupt runs, and nothing spins:
+
+    Capture.begin(8);               // 0.4 us ticks at 20 MHz
+    ...
+    unsigned long us = Capture.ticksToMicros(Capture.period());
+    unsigned int d = Capture.duty(); // 0-65535 of full scale
+
+  Timer1 overflows are counted to stretch the 16-bit count to 32 bits, so
+  periods up to 2^32 ticks (28 minutes at clk/8) come out right.  With
+  CAPTURE_BOTH the edge alternates, giving the high time and so the duty
+  as well as the period; with CAPTURE_RISING only rising edges are taken,
+  which halves the interrupt load.  The last CAPTURE_HISTORY periods are
+  kept for averagePeriod() and history().  Pulses shorter than the
+  interrupt latency, a few microseconds, can be missed in CAPTURE_BOTH
+  mode.
+
+  Capture needs Timer1 counting up freely, so begin() takes it over from
+  analogWrite() on pins 12 and 13, pwm16Begin() and tone() on Timer1;
+  end() gives it back as init() set it.  Pin 14 can't use analogWrite()
+  while it is an input.
+*/
+#ifndef Capture_h
+#define Capture_h
+
+#include <inttypes.h>
+
+#define CAPTURE_HISTORY 8
+
+#define CAPTURE_RISING 0
+#define CAPTURE_BOTH 1
+
+class InputCapture
+{
+  public:
+    InputCapture();
+    // prescale is the Timer1 clock divider: 1, 8, 64, 256 or 1024.  filter
+    // turns on the hardware noise canceller, which wants the input steady
+    // for four ticks and delays each capture by as much.  Returns 1 for a
+    // bad prescale.
+    int begin(unsigned int prescale = 8, uint8_t edges = CAPTURE_BOTH,
+              boolean filter = false);
+    void end();
+    // Timer1 ticks since begin(), 32 bits
+    unsigned long now();
+    // Last complete period, rising edge to rising edge, in ticks.  0 until
+    // two rising edges have been seen.
+    unsigned long period();
+    // High time within the last complete period, in ticks (CAPTURE_BOTH)
+    unsigned long highTime();
+    // High time as a fraction of the period, 0 to 65535 (CAPTURE_BOTH)
+    unsigned int duty();
+    // Mean of the periods in the history, in ticks
+    unsigned long averagePeriod();
+    // Of the last period, in Hz
+    float frequency();
+    // Ticks since the last edge, to spot a stopped input: period() keeps
+    // its last value when the edges stop coming
+    unsigned long sinceEdge();
+    // Copies up to max periods, newest first, and returns how many
+    uint8_t history(unsigned long *periods, uint8_t max);
+    // Edges captured since begin()
+    unsigned long edges();
+    unsigned long ticksToMicros(unsigned long ticks);
+    // Called from the Timer1 interrupts
+    void capture();
+    void overflow();
+  private:
+    unsigned long timestamp(unsigned int count);
+    unsigned int _prescale;
+    uint8_t _edges;
+    volatile unsigned int _overflows;
+    unsigned long _last_rise;
+    volatile unsigned long _last_edge;
+    volatile unsigned long _period;
+    volatile unsigned long _high;
+    volatile unsigned long _count;
+    unsigned long _history[CAPTURE_HISTORY];
+    uint8_t _head;
+    volatile uint8_t _filled;
+};
+
+extern InputCapture Capture;
+
+#endif
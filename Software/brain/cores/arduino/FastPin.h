@@ -0,0 +1,94 @@
+/*
+  FastPin.h - Digital I/O for pins known at compile time.
+
+  digitalWrite() and friends look the pin up in three flash tables and
+  check for PWM on every call, about 50 cycles.  When the pin number is a
+  constant the port and bit can be worked out by the compiler instead:
+
+    digitalWriteFast(13, HIGH);   // one sbi, 2 cycles
+    if (digitalReadFast(3)) ...   // one sbis
+    digitalToggleFast(13);        // writes the bit to PIND
+    pinModeFast(13, OUTPUT);
+
+  All of these are single instructions on the port registers, so they are
+  atomic with respect to interrupts.  If the pin is not a constant they
+  fall back to the normal runtime functions.  FastPin<13> wraps the same
+  thing up as a type, for passing pins to templates:
+
+    FastPin<13> led;
+    led.output();
+    led.toggle();
+
+  Unlike digitalWrite(), the fast versions don't turn PWM off on the pin;
+  use digitalWrite() once first if the pin was used with analogWrite().
+  The mapping below must match the tables in pins_arduino.c.
+*/
+#ifndef FastPin_h
+#define FastPin_h
+
+#include <avr/io.h>
+#include "wiring.h"
+#include "pins_arduino.h"
+
+#define FAST_PIN_COUNT 32
+
+// Pins 0-7 are PB0-7, 8-15 PD0-7, 16-23 PC0-7 and 24-31 PA7 down to PA0
+#define fastPinRegister(P, reg) \
+	((P) < 8 ? &reg##B : (P) < 16 ? &reg##D : (P) < 24 ? &reg##C : &reg##A)
+#define fastPinOutputRegister(P) fastPinRegister(P, PORT)
+#define fastPinInputRegister(P) fastPinRegister(P, PIN)
+#define fastPinModeRegister(P) fastPinRegister(P, DDR)
+#define fastPinBitMask(P) ((P) < 24 ? _BV((P) & 7) : _BV(7 - ((P) & 7)))
+
+#define fastPinConstant(P) (__builtin_constant_p(P) && (P) < FAST_PIN_COUNT)
+
+#define digitalWriteFast(P, V) do { \
+	if (fastPinConstant(P)) { \
+		if (V) *fastPinOutputRegister(P) |= fastPinBitMask(P); \
+		else *fastPinOutputRegister(P) &= ~fastPinBitMask(P); \
+	} else { \
+		digitalWrite((P), (V)); \
+	} \
+} while (0)
+
+#define digitalReadFast(P) \
+	(fastPinConstant(P) ? \
+		((*fastPinInputRegister(P) & fastPinBitMask(P)) ? HIGH : LOW) : \
+		digitalRead(P))
+
+#define pinModeFast(P, M) do { \
+	if (fastPinConstant(P)) { \
+		if ((M) == INPUT) *fastPinModeRegister(P) &= ~fastPinBitMask(P); \
+		else *fastPinModeRegister(P) |= fastPinBitMask(P); \
+	} else { \
+		pinMode((P), (M)); \
+	} \
+} while (0)
+
+// Writing a one to a PINx bit flips the output
+#define digitalToggleFast(P) do { \
+	if (fastPinConstant(P)) \
+		*fastPinInputRegister(P) = fastPinBitMask(P); \
+	else if (digitalPinToPort(P) != NOT_A_PIN) \
+		*portInputRegister(digitalPinToPort(P)) = digitalPinToBitMask(P); \
+} while (0)
+
+#ifdef __cplusplus
+template <uint8_t pin>
+class FastPin
+{
+  public:
+    static inline void high() { *fastPinOutputRegister(pin) |= fastPinBitMask(pin); }
+    static inline void low() { *fastPinOutputRegister(pin) &= ~fastPinBitMask(pin); }
+    static inline void write(uint8_t value) { if (value) high(); else low(); }
+    static inline void toggle() { *fastPinInputRegister(pin) = fastPinBitMask(pin); }
+    static inline uint8_t read() { return (*fastPinInputRegister(pin) & fastPinBitMask(pin)) ? HIGH : LOW; }
+    static inline void output() { *fastPinModeRegister(pin) |= fastPinBitMask(pin); }
+    static inline void input() { *fastPinModeRegister(pin) &= ~fastPinBitMask(pin); }
+  private:
+    // Fails to compile for a pin the board doesn't have
+    typedef char pin_in_range[pin < FAST_PIN_COUNT ? 1 : -1];
+};
+#endif
+
+#endif
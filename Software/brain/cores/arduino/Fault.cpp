@@ -0,0 +1,152 @@
+/*
+  Fault.cpp - Overcurrent shutdown from the analog comparator.
+  See Fault.h for how to use it.
+*/
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "Fault.h"
+
+FaultProtection Fault;
+
+ISR(ANALOG_COMP_vect) {
+  // Outputs off first, the book-keeping can wait
+  pwmShutdown();
+  Fault.comparator();
+}
+
+FaultProtection::FaultProtection() {
+  _tripped = false;
+  _reported = true;
+  _armed = false;
+  _source = FAULT_NONE;
+  _time = 0;
+  _count = 0;
+}
+
+void FaultProtection::begin(uint8_t channel, uint8_t reference) {
+  // The interrupt has to be off while the edge is changed
+  ACSR &= ~_BV(ACIE);
+  // The multiplexer feeds the comparator only with the ADC off
+  ADCSRA &= ~_BV(ADEN);
+  ADCSRB |= _BV(ACME);
+  ADMUX = (ADMUX & ~0x07) | (channel & 0x07);
+  if (reference == FAULT_REF_AIN0)
+    DIDR1 |= _BV(AIN0D);
+  // The output is high while the reference is above the sense input, so
+  // a fault is a falling edge
+  ACSR = (reference == FAULT_REF_BANDGAP ? _BV(ACBG) : 0) | _BV(ACIS1);
+  // Give the bandgap time to settle before trusting the output
+  delayMicroseconds(100);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  _count = 0;
+  _armed = true;
+  ACSR |= _BV(ACI);
+  ACSR |= _BV(ACIE);
+  SREG = oldSREG;
+
+  // No edge is coming if it is over the threshold already
+  if (overThreshold())
+    trip(FAULT_COMPARATOR);
+}
+
+void FaultProtection::end() {
+  ACSR &= ~_BV(ACIE);
+  ACSR = _BV(ACI);
+  ADCSRB &= ~_BV(ACME);
+  ADCSRA |= _BV(ADEN);
+  _armed = false;
+}
+
+boolean FaultProtection::overThreshold() {
+  return _armed && !(ACSR & _BV(ACO));
+}
+
+void FaultProtection::comparator() {
+  latch(FAULT_COMPARATOR);
+}
+
+void FaultProtection::trip(uint8_t source) {
+  pwmShutdown();
+  latch(source);
+}
+
+void FaultProtection::latch(uint8_t source) {
+  uint8_t oldSREG = SREG;
+  cli();
+  _count++;
+  // Keep the first trip until it is cleared
+  if (!_tripped) {
+    _tripped = true;
+    _reported = false;
+    _source = source;
+    _time = micros();
+  }
+  SREG = oldSREG;
+}
+
+boolean FaultProtection::tripped() {
+  return _tripped;
+}
+
+uint8_t FaultProtection::source() {
+  return _source;
+}
+
+unsigned long FaultProtection::time() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long time = _time;
+  SREG = oldSREG;
+  return time;
+}
+
+unsigned int FaultProtection::count() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int count = _count;
+  SREG = oldSREG;
+  return count;
+}
+
+int FaultProtection::clear() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (overThreshold()) {
+    SREG = oldSREG;
+    return 1;
+  }
+  _tripped = false;
+  _reported = true;
+  _source = FAULT_NONE;
+  pwmUnlock();
+  SREG = oldSREG;
+  return 0;
+}
+
+boolean FaultProtection::report(int id) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!_tripped || _reported) {
+    SREG = oldSREG;
+    return false;
+  }
+  _reported = true;
+  uint8_t source = _source;
+  unsigned long time = _time;
+  unsigned int count = _count;
+  SREG = oldSREG;
+
+  char data[8];
+  data[0] = source;
+  data[1] = time & 0xFF;
+  data[2] = (time >> 8) & 0xFF;
+  data[3] = (time >> 16) & 0xFF;
+  data[4] = time >> 24;
+  data[5] = count & 0xFF;
+  data[6] = count >> 8;
+  data[7] = overThreshold();
+  Can.send(CanMessage(id, data));
+  return true;
+}
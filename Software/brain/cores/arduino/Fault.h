@@ -0,0 +1,86 @@
+/*
+  Fault.h - Overcurrent shutdown from the analog comparator.
+
+  Polling a current sense input with analogRead() in loop() and then
+  calling analogWrite(pin, 0) takes as long as the loop does, often
+  milliseconds.  Fault arms the analog comparator instead: when the sense
+  voltage rises above the reference the comparator interrupt calls
+  pwmShutdown(), which disconnects every connected PWM output and drives
+  its pin low within a few microseconds of the crossing.
+
+  The sense input is one of the analog channels, through the ADC
+  multiplexer, and the reference is the internal 1.1 V bandgap or the AIN0
+  pin (pin 2, PB2) for a divider set threshold.  AIN1 would be the usual
+  negative input, but on this board it is the MCP2515 INT pin.  The
+  multiplexer can only feed the comparator while the ADC is off, so
+  analogRead() and AnalogScan can't be used while Fault is armed.  Boards
+  that need the ADC can instead call Fault.trip() themselves, from an
+  AnalogScan callback for example, at the cost of a conversion's latency.
+
+  A fault latches: the outputs stay off, analogWrite() and pwm16Connect()
+  leave them off, until clear(), which refuses while the input is still
+  over the threshold.  The time of the trip is kept, and report() sends it
+  over CAN once from loop(), since CAN can't be used from the interrupt.
+
+    Fault.begin(0, FAULT_REF_BANDGAP);   // trip when A0 passes 1.1 V
+    ...
+    Fault.report(FAULT_ID);               // in loop()
+*/
+#ifndef Fault_h
+#define Fault_h
+
+#include <inttypes.h>
+
+#define FAULT_REF_BANDGAP 0
+#define FAULT_REF_AIN0 1
+
+// What tripped, from source()
+#define FAULT_NONE 0
+#define FAULT_COMPARATOR 1
+#define FAULT_SOFTWARE 2
+
+class FaultProtection
+{
+  public:
+    FaultProtection();
+    // Arms the comparator on analog channel (0-7) against reference.  If
+    // the input is already over the threshold it trips at once.
+    void begin(uint8_t channel, uint8_t reference = FAULT_REF_BANDGAP);
+    // Disarms the comparator and turns the ADC back on.  A latched fault
+    // stays latched.
+    void end();
+    // Shuts the outputs down and latches a fault.  Can be called from an
+    // interrupt.
+    void trip(uint8_t source = FAULT_SOFTWARE);
+    boolean tripped();
+    // FAULT_COMPARATOR or FAULT_SOFTWARE for the latched fault
+    uint8_t source();
+    // micros() when the latched fault tripped
+    unsigned long time();
+    // Trips since begin()
+    unsigned int count();
+    // Clears the latched fault and lets analogWrite() drive the outputs
+    // again.  Returns 1, leaving the fault latched, if the comparator
+    // still sees the input over the threshold.
+    int clear();
+    // Sends one frame on id for each latched fault, the first time it is
+    // called after the trip: source, time (4 bytes), count (2 bytes) and
+    // whether the input is still over the threshold, all little endian.
+    // Returns true if it sent one.
+    boolean report(int id);
+    // Called from the analog comparator interrupt
+    void comparator();
+  private:
+    boolean overThreshold();
+    void latch(uint8_t source);
+    volatile boolean _tripped;
+    boolean _reported;
+    boolean _armed;
+    volatile uint8_t _source;
+    volatile unsigned long _time;
+    volatile unsigned int _count;
+};
+
+extern FaultProtection Fault;
+
+#endif
@@ -24,9 +24,64 @@ CanMessage::CanMessage(int _id, const char * _data, char _len) {
   len = _len;
 }
 
+CanMailbox::CanMailbox(int id) {
+  _id = id;
+  _next = 0;
+  _time = 0;
+  _sequence = 0;
+  _read = 0;
+}
+
+int CanMailbox::id() {
+  return _id;
+}
+
+unsigned int CanMailbox::sequence() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int result = _sequence;
+  SREG = oldSREG;
+  return result;
+}
+
+/* Copies with interrupts on, and again if the sequence number moved
+   meanwhile.  Frames are at least 50 us apart even at 1 Mbps, several
+   times as long as the copy, so it is rarely needed twice. */
+unsigned int CanMailbox::read(CanMessage &msg, unsigned long *time) {
+  unsigned int before, after;
+  do {
+    before = sequence();
+    msg = _msg;
+    if (time)
+      *time = _time;
+    after = sequence();
+  } while (before != after);
+  _read = after;
+  return after;
+}
+
+boolean CanMailbox::updated() {
+  return sequence() != _read;
+}
+
+void CanMailbox::store(CanMessage &msg) {
+  _msg = msg;
+  _time = millis();
+  // 0 is kept for "nothing yet"
+  if (++_sequence == 0)
+    _sequence = 1;
+}
+
 HardwareCan::HardwareCan(int CsPin, int IntPin) {
   _CsPin = CsPin;
   _IntPin = IntPin;
+  _accept = 0;
+  _rejected = 0;
+  _mailboxes = 0;
+  // The MCP2515 comes out of reset with its filters on
+  _filtering = true;
+  for (uint8_t i = 0; i < CAN_FILTERS; i++)
+    _filter_func[i] = 0;
   _mcp2515 = Mcp2515(CsPin);
 }
 
@@ -92,9 +147,22 @@ int HardwareCan::frequency(int hz) {
   3 if both channels are available
 */
 int HardwareCan::available() {
+  return available(0);
+}
+
+int HardwareCan::available(uint8_t *filter) {
   // status() returns 0b1000000, 0b01000000, or 0b11000000
   // depending on the status of either of the channel
-  return (_mcp2515.rxStatus() >> 6) & 0x03;
+  const char status = _mcp2515.rxStatus();
+  if (filter) {
+    // Bits [2:0] are for RXB0 when both buffers are full, which is the one
+    // recv() reads first.  6 and 7 are RXF0 and RXF1 rolled over to RXB1.
+    uint8_t hit = status & 0x07;
+    if (hit >= CAN_FILTERS)
+      hit -= CAN_FILTERS;
+    *filter = _filtering ? hit : CAN_NO_FILTER;
+  }
+  return (status >> 6) & 0x03;
 }
 
 // Returns 1 if there is a pending interrupt, 0 otherwise
@@ -102,15 +170,16 @@ boolean HardwareCan::interrupted() {
   return !digitalRead(_IntPin);
 }
 
-/* Sends can message. 0 on success, 1 on error */
+/* Sends can message. 0 on success, 1 on error (all TX buffers busy) */
 int HardwareCan::send(CanMessage msg) {
-  PCICR &=~ 0x02;  // Disable PC1 Interrupt
-  _mcp2515.send(msg.len, msg.id, msg.data);
-  PCICR |= 0x02;   // Re-enable PC1 interrupt
-  return 0;
+  suspendPinChangeInterrupt(_IntPin);
+  int result = _mcp2515.send(msg.len, msg.id, msg.data);
+  resumePinChangeInterrupt(_IntPin);
+  return result;
 }
 
-/* Receives can message from channel. 0 on success, error otherwise */
+/* Receives can message from channel. 0 on success, 2 if the software
+   filter threw it away, error otherwise */
 int HardwareCan::recv(int channel, CanMessage &msg) {
   // Invalid channel
   if (channel != 1 && channel != 2 && channel != 3)
@@ -120,7 +189,12 @@ int HardwareCan::recv(int channel, CanMessage &msg) {
   if (channel == 3)
     channel = 1;
   // Note: receive() expects channel = 0 or 1 instead of 1 or 2
-  msg.len = _mcp2515.receive(channel-1, &msg.id, msg.data);
+  int len = _mcp2515.receive(channel-1, &msg.id, msg.data, _accept);
+  if (len < 0) {
+    _rejected++;
+    return 2;
+  }
+  msg.len = len;
   return 0;
 }
 
@@ -177,18 +251,103 @@ int HardwareCan::setMask(int channel, int id) {
 
 // Turn on hardware filtering
 void HardwareCan::filterOn() {
+  _filtering = true;
   _mcp2515.write(RXB0CTRL, 0x04);
   _mcp2515.write(RXB1CTRL, 0x00);
 }
 
 // Turn off hardware filtering, receives all messages
 void HardwareCan::filterOff() {
+  _filtering = false;
   _mcp2515.write(RXB0CTRL, 0x64);
   _mcp2515.write(RXB1CTRL, 0x60);
 }
 
+/* Turns the software acceptance filter on with the given bitmap, or off */
+void HardwareCan::acceptFilter(unsigned char *bitmap) {
+  uint8_t oldSREG = SREG;
+  cli();
+  _accept = bitmap;
+  SREG = oldSREG;
+}
+
+void HardwareCan::accept(int id) {
+  acceptRange(id, id, true);
+}
+
+// Accepts all of first to last
+void HardwareCan::accept(int first, int last) {
+  acceptRange(first, last, true);
+}
+
+void HardwareCan::reject(int id) {
+  acceptRange(id, id, false);
+}
+
+void HardwareCan::reject(int first, int last) {
+  acceptRange(first, last, false);
+}
+
+// Each byte is changed with one store, which the receive interrupt can
+// only see before or after, and it never writes the bitmap itself
+void HardwareCan::acceptRange(int first, int last, boolean on) {
+  if (!_accept || first < 0 || last > 0x7FF)
+    return;
+  for (int id = first; id <= last; id++) {
+    if (on)
+      _accept[id >> 3] |= 1 << (id & 0x07);
+    else
+      _accept[id >> 3] &= ~(1 << (id & 0x07));
+  }
+}
+
+unsigned int HardwareCan::rejected() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int result = _rejected;
+  SREG = oldSREG;
+  return result;
+}
+
+void HardwareCan::subscribe(CanMailbox &box) {
+  uint8_t oldSREG = SREG;
+  cli();
+  CanMailbox *m;
+  for (m = _mailboxes; m; m = m->_next)
+    if (m == &box)
+      break;
+  if (!m) {
+    box._next = _mailboxes;
+    _mailboxes = &box;
+  }
+  SREG = oldSREG;
+}
+
+void HardwareCan::unsubscribe(CanMailbox &box) {
+  uint8_t oldSREG = SREG;
+  cli();
+  for (CanMailbox **m = &_mailboxes; *m; m = &(*m)->_next) {
+    if (*m == &box) {
+      *m = box._next;
+      break;
+    }
+  }
+  SREG = oldSREG;
+}
+
+boolean HardwareCan::deliver(CanMessage &msg) {
+  for (CanMailbox *m = _mailboxes; m; m = m->_next) {
+    if (m->id() == msg.id) {
+      m->store(msg);
+      return true;
+    }
+  }
+  return false;
+}
+
 /* Sends a reset to Mcp2515 */
 void HardwareCan::reset() {
+  _filtering = true;
   _mcp2515.reset();
   delay(10);
 }
@@ -209,6 +368,36 @@ void HardwareCan::monitor(boolean silent) {
     _mcp2515.write(CANCTRL, 0x00);  // Normal mode
 }
 
+/* Puts the MCP2515 to sleep with the wake up interrupt enabled.  Activity
+   on the bus then sets WAKIF, which pulls the INT pin low and, through the
+   pin change interrupt, wakes the ATmega from powerSave().  The frame that
+   wakes the controller is not received.  Call wake() before using it. */
+void HardwareCan::sleep() {
+  suspendPinChangeInterrupt(_IntPin);
+  _mcp2515.modify(CANINTF, 0x40, 0x00);
+  _mcp2515.modify(CANINTE, 0x40, 0x40);  // WAKIE
+  _mcp2515.write(CANCTRL, 0x20);         // Sleep mode
+  resumePinChangeInterrupt(_IntPin);
+}
+
+/* Brings the MCP2515 back to normal mode after sleep(), whether or not bus
+   activity has already woken it.  Setting WAKIF from the SPI side wakes it
+   too; it comes up in listen only mode and is switched back from there. */
+void HardwareCan::wake() {
+  suspendPinChangeInterrupt(_IntPin);
+  _mcp2515.modify(CANINTF, 0x40, 0x40);
+  // The oscillator takes 128 cycles to start before the mode can change
+  for (uint8_t tries = 0; tries < 10; tries++) {
+    monitor(0);
+    if ((_mcp2515.read(CANSTAT) & 0xE0) == 0x00)
+      break;
+    delayMicroseconds(50);
+  }
+  _mcp2515.modify(CANINTE, 0x40, 0x00);
+  _mcp2515.modify(CANINTF, 0x40, 0x00);
+  resumePinChangeInterrupt(_IntPin);
+}
+
 /* Attaches a callback to a packet receive event */
 void HardwareCan::attach(void (*func)(CanMessage &msg)) {
   _func = func;
@@ -219,43 +408,107 @@ void HardwareCan::detach() {
   _func = 0;
 }
 
+/* Attaches a callback to frames accepted by one hardware filter */
+void HardwareCan::attachFilter(uint8_t filter, void (*func)(CanMessage &msg)) {
+  if (filter >= CAN_FILTERS)
+    return;
+  uint8_t oldSREG = SREG;
+  cli();
+  _filter_func[filter] = func;
+  SREG = oldSREG;
+}
+
+void HardwareCan::detachFilter(uint8_t filter) {
+  attachFilter(filter, 0);
+}
+
 /* Returns number of RX errors */
 unsigned int HardwareCan::rxError() {
   // Read Receieve error count register
-  PCICR &=~ 0x02;
+  suspendPinChangeInterrupt(_IntPin);
   unsigned int result = 0xFF & _mcp2515.read(REC);
-  PCICR |= 0x02;   // Re-enable PC1 interrupt
+  resumePinChangeInterrupt(_IntPin);
   return result;
 }
 
 /* Returns number of TX errors */
 unsigned int HardwareCan::txError() {
   // Read Transmit error count register
-  PCICR &=~ 0x02;
+  suspendPinChangeInterrupt(_IntPin);
   unsigned int result = 0xFF & _mcp2515.read(TEC);
-  PCICR |= 0x02;   // Re-enable PC1 interrupt
+  resumePinChangeInterrupt(_IntPin);
+  return result;
+}
+
+/* Returns the EFLG error flags and clears the RX overflow bits in it:
+  Bit 0: Error warning (either counter >= 96)
+  Bit 3: RX error passive
+  Bit 4: TX error passive
+  Bit 5: Bus off
+  Bit 6: RX buffer 0 overflow
+  Bit 7: RX buffer 1 overflow
+*/
+unsigned char HardwareCan::errorFlags() {
+  suspendPinChangeInterrupt(_IntPin);
+  unsigned char result = _mcp2515.read(EFLG);
+  if (result & 0xC0)
+    _mcp2515.modify(EFLG, 0xC0, 0x00);
+  resumePinChangeInterrupt(_IntPin);
   return result;
 }
 
 // Init an instance for the CalSol Brain
 HardwareCan Can = HardwareCan(4, 3);
 
-CanMessage _can_buffer[CAN_BUFFER_SIZE];
+// Frames live in a pool of blocks; the queue holds block numbers
+CanMessage _can_pool[CAN_BUFFER_SIZE];
+uint8_t _can_buffer[CAN_BUFFER_SIZE];
 // Needs to be declaired volatile since it can be changed in an ISR
 volatile uint8_t _can_buffer_start = 0;
 volatile uint8_t _can_buffer_end = 0;
 volatile uint8_t _can_buffer_size = 0;
-// Brain specific stuff
-// This Interrupt Service Routine triggers whenever any pins on port B changes
-ISR(PCINT1_vect) {
-  // We only care about pin 3 (PB3), so we only call our handler if pin 3 is low
-  if (digitalRead(3) == 0)
-    CanReadHandler();
+// Frames thrown away because the pool was empty
+volatile unsigned int _can_buffer_overruns = 0;
+// Released blocks, reused last in first out.  Blocks from _can_pool_fresh
+// up have never been handed out.
+static uint8_t _can_pool_free[CAN_BUFFER_SIZE];
+static volatile uint8_t _can_pool_free_count = 0;
+static volatile uint8_t _can_pool_fresh = 0;
+static volatile uint8_t _can_pool_high_water = 0;
+// millis() when the frame in each block was received
+static unsigned long _can_pool_time[CAN_BUFFER_SIZE];
+// Set while a block is queued or held, so a second release can be ignored
+static uint8_t _can_pool_used[CAN_BUFFER_SIZE];
+
+#define CAN_NO_BLOCK 0xFF
+
+/* Takes a free block, or returns CAN_NO_BLOCK.  Interrupts must be off. */
+static uint8_t canPoolAlloc() {
+  uint8_t block;
+  if (_can_pool_free_count)
+    block = _can_pool_free[--_can_pool_free_count];
+  else if (_can_pool_fresh < CAN_BUFFER_SIZE)
+    block = _can_pool_fresh++;
+  else
+    return CAN_NO_BLOCK;
+  _can_pool_used[block] = 1;
+  return block;
 }
+
+/* Puts a block back on the free list.  Interrupts must be off. */
+static void canPoolRelease(uint8_t block) {
+  if (!_can_pool_used[block])
+    return;
+  _can_pool_used[block] = 0;
+  _can_pool_free[_can_pool_free_count++] = block;
+}
+
 /* this has to be called to set up interrupts correctly */
 void CanBufferInit() {
-  PCMSK1 |= 0x08;  // PC Interrupt #11 (Thats the CAN INT pin) enable
-  PCICR |= 0x02; // PC Interrupt 1 enable
+  // Brain specific stuff: the MCP2515 INT is pin 3 (PB3, PCINT11).  It stays
+  // low while frames are waiting, so the handler runs on every port B pin
+  // change interrupt for as long as it is low, not just on the falling edge.
+  attachPinChangeInterrupt(3, CanReadHandler, LOW);
   DDRC |= (1<<5);
   CanReadHandler();
 }
@@ -263,36 +516,136 @@ void CanBufferInit() {
     if there are no messages in the buffer.
     An invalid message has its length set to -1 */
 CanMessage CanBufferRead() {
+  CanMessage *msg = CanBufferTake();
+  if (!msg)
+    return CanMessage(0);  // Invalid packet
+  const CanMessage result = *msg;
+  CanBufferRelease(msg);
+  return result;
+}
+/* Takes the oldest message off the queue without copying it, or returns 0
+    if there are none.  The block stays ours until CanBufferRelease(). */
+CanMessage *CanBufferTake() {
+  CanMessage *msg = 0;
+  uint8_t oldSREG = SREG;
+  cli();
   if (_can_buffer_size) {
-    const CanMessage result = _can_buffer[_can_buffer_start];
+    msg = &_can_pool[_can_buffer[_can_buffer_start]];
     // Modulus
     _can_buffer_start = (_can_buffer_start == CAN_BUFFER_SIZE-1) ? 0 : _can_buffer_start+1;
     _can_buffer_size--;
-    return result;
-  } else {
-    return CanMessage(0);  // Invalid packet
   }
+  SREG = oldSREG;
+  return msg;
+}
+/* Gives a block from CanBufferTake() back to the pool.  Releasing one
+    that is already free does nothing. */
+void CanBufferRelease(CanMessage *msg) {
+  if (msg < _can_pool || msg >= _can_pool + CAN_BUFFER_SIZE)
+    return;
+  uint8_t oldSREG = SREG;
+  cli();
+  canPoolRelease(msg - _can_pool);
+  SREG = oldSREG;
+}
+/* When a block from CanBufferTake() or CanBufferPeek() was received, in
+    millis() */
+unsigned long CanBufferTime(const CanMessage *msg) {
+  if (msg < _can_pool || msg >= _can_pool + CAN_BUFFER_SIZE)
+    return 0;
+  return _can_pool_time[msg - _can_pool];
+}
+/* Takes the oldest n queued messages off the queue and puts their blocks
+    back in the pool.  The interrupt only adds at the other end, so they
+    can be read in place first. */
+static void canBufferRemove(uint8_t n) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t start = _can_buffer_start;
+  for (uint8_t i = 0; i < n; i++) {
+    canPoolRelease(_can_buffer[start]);
+    start = (start == CAN_BUFFER_SIZE-1) ? 0 : start+1;
+  }
+  _can_buffer_start = start;
+  _can_buffer_size -= n;
+  SREG = oldSREG;
+}
+/* The oldest message, left on the queue, or 0 if there are none */
+CanMessage *CanBufferPeek() {
+  if (!_can_buffer_size)
+    return 0;
+  return &_can_pool[_can_buffer[_can_buffer_start]];
+}
+/* Copies up to n messages into msgs, oldest first, and takes them off the
+    queue.  Returns how many. */
+uint8_t CanBufferPop(CanMessage *msgs, uint8_t n) {
+  uint8_t count = _can_buffer_size;
+  if (count > n)
+    count = n;
+  uint8_t index = _can_buffer_start;
+  for (uint8_t i = 0; i < count; i++) {
+    msgs[i] = _can_pool[_can_buffer[index]];
+    index = (index == CAN_BUFFER_SIZE-1) ? 0 : index+1;
+  }
+  canBufferRemove(count);
+  return count;
+}
+/* Calls func on each message queued now, oldest first, then takes them all
+    off the queue.  Frames that arrive meanwhile are left for next time.
+    A null func just throws them away.  Returns how many. */
+uint8_t CanBufferDrain(void (*func)(CanMessage &msg)) {
+  uint8_t count = _can_buffer_size;
+  if (func) {
+    uint8_t index = _can_buffer_start;
+    for (uint8_t i = 0; i < count; i++) {
+      func(_can_pool[_can_buffer[index]]);
+      index = (index == CAN_BUFFER_SIZE-1) ? 0 : index+1;
+    }
+  }
+  canBufferRemove(count);
+  return count;
 }
 /* Called by Pin change ISR if CANINT has a falling edge.  That means the
     mcp2515 has a message ready to be read */
 void CanReadHandler() {
   // While we still have packets
   while (1) {
-    int available = Can.available();
+    uint8_t filter;
+    int available = Can.available(&filter);
     if (!available)
       return;
+    if (filter != CAN_NO_FILTER && Can._filter_func[filter]) {
+      CanMessage packet;
+      if (!Can.recv(available, packet))
+        Can._filter_func[filter](packet);
+      continue;
+    }
     if (Can._func) {
       CanMessage packet;
-      Can.recv(available, packet);
-      Can._func(packet);
+      if (!Can.recv(available, packet) && !Can.deliver(packet))
+        Can._func(packet);
       continue;
     }
-    if (_can_buffer_size && _can_buffer_start == _can_buffer_end) {
-      CanMessage dummy;
-      Can.recv(available, dummy);
+    // The queue is as long as the pool, so a block always has a place.
+    // With the pool empty a frame can still go to a mailbox.
+    uint8_t block = canPoolAlloc();
+    CanMessage dummy;
+    CanMessage &msg = (block == CAN_NO_BLOCK) ? dummy : _can_pool[block];
+    if (Can.recv(available, msg) || Can.deliver(msg)) {
+      // Filtered out or in a mailbox, the block goes straight back
+      if (block != CAN_NO_BLOCK)
+        canPoolRelease(block);
       continue;
     }
-    Can.recv(available, _can_buffer[_can_buffer_end]);
+    if (block == CAN_NO_BLOCK) {
+      _can_buffer_overruns++;
+      continue;
+    }
+    uint8_t used = _can_pool_fresh - _can_pool_free_count;
+    if (used > _can_pool_high_water)
+      _can_pool_high_water = used;
+    _can_pool_time[block] = millis();
+    _can_buffer[_can_buffer_end] = block;
     // Increment
     _can_buffer_end++;
     if (_can_buffer_end == CAN_BUFFER_SIZE) _can_buffer_end = 0;
@@ -301,4 +654,29 @@ void CanReadHandler() {
 }
 int CanBufferSize() {
   return _can_buffer_size;
+}
+/* Number of received messages dropped because the pool was empty */
+unsigned int CanBufferOverruns() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int result = _can_buffer_overruns;
+  SREG = oldSREG;
+  return result;
+}
+uint8_t CanPoolFree() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t result = CAN_BUFFER_SIZE - (_can_pool_fresh - _can_pool_free_count);
+  SREG = oldSREG;
+  return result;
+}
+uint8_t CanPoolHighWater() {
+  return _can_pool_high_water;
+}
+/* Starts the high water mark again from the blocks in use now */
+void CanPoolResetHighWater() {
+  uint8_t oldSREG = SREG;
+  cli();
+  _can_pool_high_water = _can_pool_fresh - _can_pool_free_count;
+  SREG = oldSREG;
 }
\ No newline at end of file
@@ -9,6 +9,11 @@
 #include "mcp2515.h"
 
 #define CAN_BUFFER_SIZE 30
+// Bytes in a software acceptance bitmap, one bit per standard ID
+#define CAN_ID_BITMAP_SIZE 256
+// MCP2515 acceptance filters RXF0 to RXF5, and "no filter match known"
+#define CAN_FILTERS 6
+#define CAN_NO_FILTER 0xFF
 
 class CanMessage {
   public:
@@ -20,6 +25,35 @@ class CanMessage {
     char len;
 };
 
+/* Latest value mailbox for one standard ID.  Once subscribed with
+   Can.subscribe(), frames with that ID skip the receive queue and the
+   attached callback: the interrupt overwrites the mailbox with each one,
+   so it always holds the newest frame and can't overflow.  read() gets a
+   consistent copy without keeping interrupts off for the copy; if a frame
+   lands part way through, it just copies again. */
+class CanMailbox
+{
+  public:
+    CanMailbox(int id);
+    int id();
+    // Copies the newest frame into msg, and the millis() it arrived at
+    // into time if given.  Returns its sequence number, 0 if none yet.
+    unsigned int read(CanMessage &msg, unsigned long *time = 0);
+    // Frames received so far, wrapping from 65535 to 1
+    unsigned int sequence();
+    // True if a frame has arrived since the last read()
+    boolean updated();
+    // Called from the CAN receive interrupt
+    void store(CanMessage &msg);
+    CanMailbox *_next;
+  private:
+    int _id;
+    CanMessage _msg;
+    unsigned long _time;
+    volatile unsigned int _sequence;
+    unsigned int _read;
+};
+
 class HardwareCan
 {
   public:
@@ -27,6 +61,9 @@ class HardwareCan
     void begin(int hz, bool do_reset = true);
     int frequency(int khz);
     int available();
+    // As available(), and sets filter to the RXF number (0-5) that accepted
+    // the frame recv() will read next, or CAN_NO_FILTER with filterOff()
+    int available(uint8_t *filter);
     boolean interrupted();
     int send(CanMessage msg);
     int recv(int channel, CanMessage &msg);
@@ -34,15 +71,52 @@ class HardwareCan
     int setMask(int channel, int mask);
     void filterOn();
     void filterOff();
+    // Software acceptance filter, on top of the MCP2515 masks and filters
+    // and for when there are too many IDs for them.  bitmap is
+    // CAN_ID_BITMAP_SIZE bytes of ours with bit (id & 7) of byte (id >> 3)
+    // set for each ID to keep.  Other frames are dropped by recv() and the
+    // receive interrupt once their ID is read, before the data, and never
+    // reach the queue or the attached callback.  accept() and reject()
+    // change the bitmap and are safe to call while frames are arriving.
+    // acceptFilter(0) turns the stage off.
+    void acceptFilter(unsigned char *bitmap);
+    void accept(int id);
+    void accept(int first, int last);
+    void reject(int id);
+    void reject(int first, int last);
+    // Frames dropped by the software filter
+    unsigned int rejected();
+    // Delivers frames with the mailbox's ID to it from now on
+    void subscribe(CanMailbox &box);
+    void unsubscribe(CanMailbox &box);
+    // Called from the CAN receive interrupt.  Stores msg in its mailbox,
+    // if it has one, and returns true if it did.
+    boolean deliver(CanMessage &msg);
     void reset();
     void config(boolean enable);
     void monitor(boolean silent);
+    void sleep();
+    void wake();
     void attach(void (*func)(CanMessage &msg));
     void detach();
+    // Calls func, from the receive interrupt, with every frame accepted by
+    // hardware filter RXF0-RXF5.  Filters 0 and 1 are setFilter(1, 1) and
+    // (1, 2), 2 to 5 are setFilter(2, 1) to (2, 4).  The handler comes
+    // from the RX status the interrupt reads anyway, so no IDs are
+    // compared; these frames skip mailboxes, the queue and attach().
+    void attachFilter(uint8_t filter, void (*func)(CanMessage &msg));
+    void detachFilter(uint8_t filter);
     unsigned int rxError();
     unsigned int txError();
+    unsigned char errorFlags();
     void (*_func)(CanMessage &msg);
+    void (*_filter_func[CAN_FILTERS])(CanMessage &msg);
   private:
+    void acceptRange(int first, int last, boolean on);
+    unsigned char *_accept;
+    CanMailbox *_mailboxes;
+    boolean _filtering;
+    volatile unsigned int _rejected;
     int _CsPin;
     int _IntPin;
     int _Freq;
@@ -50,10 +124,37 @@ class HardwareCan
 };
 
 
+/* Receive queue.  The interrupt reads each frame straight into a free
+   block of a fixed pool of CAN_BUFFER_SIZE messages and queues the block.
+   CanBufferTake() hands the oldest one over without copying it; give it
+   back with CanBufferRelease() once done.  A second release is ignored
+   until the block is reused, so still release it only once.  Blocks held by
+   the loop count against the pool, so a frame is only dropped (and counted
+   in CanBufferOverruns()) when every block is queued or held.
+   CanBufferRead() is the copying version, for one frame at a time.
+   CanBufferTime() gives the millis() at which a queued frame came in.
+
+   CanBufferPeek() looks at the oldest frame in place, CanBufferPop() copies
+   up to n frames into an array and CanBufferDrain() calls a function on
+   every frame queued when it starts.  The frames are read where they are,
+   with interrupts on; only taking them off the queue and releasing them,
+   once per batch, is done with interrupts off.  All of these are for one
+   consumer, the loop: a drain callback must not take frames itself. */
 void CanReadHandler();
 extern void CanBufferInit();
 extern CanMessage CanBufferRead();
+extern CanMessage *CanBufferTake();
+extern void CanBufferRelease(CanMessage *msg);
+extern unsigned long CanBufferTime(const CanMessage *msg);
+extern CanMessage *CanBufferPeek();
+extern uint8_t CanBufferPop(CanMessage *msgs, uint8_t n);
+extern uint8_t CanBufferDrain(void (*func)(CanMessage &msg));
 extern int CanBufferSize();
+extern unsigned int CanBufferOverruns();
+// Blocks not queued or held, and the most ever in use at once
+extern uint8_t CanPoolFree();
+extern uint8_t CanPoolHighWater();
+extern void CanPoolResetHighWater();
 extern HardwareCan Can;
 
 #endif
\ No newline at end of file
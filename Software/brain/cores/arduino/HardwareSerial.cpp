@@ -58,6 +58,10 @@ void HardwareSerial::write(uint8_t b) {
   serialWrite(_uart, b);
 }
 
+void HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  serialWriteBuffer(_uart, buffer, size);
+}
+
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 HardwareSerial Serial = HardwareSerial(0);
@@ -36,6 +36,7 @@ class HardwareSerial : public Print
   int read(void);
   void flush(void);
   virtual void write(uint8_t);
+  virtual void write(const uint8_t *buffer, size_t size);
 };
 
 extern HardwareSerial Serial;
@@ -0,0 +1,435 @@
+/*
+  OneWireBus.cpp - 1-Wire bus master sequenced by Timer2 compare
+  interrupts.  See OneWireBus.h for how to use it.
+*/
+#include <util/crc16.h>
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "pins_arduino.h"
+#include "OneWireBus.h"
+
+// Timer2 runs at clk/8: 2.5 ticks a microsecond at 20 MHz
+#define ONEWIRE_TICKS(us) ((us) * (F_CPU / 100000UL) / 80)
+// Long waits go in pieces, none left too short to set up in time
+#define ONEWIRE_CHUNK 192
+
+// Where the engine is in a reset or slot
+#define PHASE_IDLE 0
+#define PHASE_RESET_LOW 1
+#define PHASE_PRESENCE 2
+#define PHASE_SLOT 3
+#define PHASE_ZERO_LOW 4
+
+// What the engine is running for
+#define JOB_TRANSFER 0
+#define JOB_SEARCH 1
+#define JOB_CONVERT 2
+#define JOB_READ 3
+
+#define ROM_SEARCH 0xF0
+#define ROM_MATCH 0x55
+#define ROM_SKIP 0xCC
+#define DS18B20_CONVERT 0x44
+#define DS18B20_READ 0xBE
+
+static const uint8_t search_command[] = { ROM_SEARCH };
+static const uint8_t convert_command[] = { ROM_SKIP, DS18B20_CONVERT };
+
+OneWireMaster OneWireBus;
+
+ISR(TIMER2_COMPB_vect) {
+  OneWireBus.step();
+}
+
+OneWireMaster::OneWireMaster() {
+  _mode = 0;
+  _phase = PHASE_IDLE;
+  _busy = false;
+  _found = 0;
+  _errors = 0;
+}
+
+void OneWireMaster::begin(uint8_t pin) {
+  end();
+  uint8_t port = digitalPinToPort(pin);
+  _mode = portModeRegister(port);
+  _in_reg = portInputRegister(port);
+  _mask = digitalPinToBitMask(pin);
+  // Released: an input, with the pull-up resistor holding it high.  The
+  // output bit stays 0 so driving it is just setting the DDR bit.
+  pinMode(pin, INPUT);
+  digitalWrite(pin, LOW);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK2 &= ~(_BV(OCIE2A) | _BV(OCIE2B) | _BV(TOIE2));
+  TCCR2B = 0;
+  TCCR2A = _BV(WGM21);
+  TCNT2 = 0;
+  TCCR2B = _BV(CS21);
+  SREG = oldSREG;
+}
+
+void OneWireMaster::end() {
+  if (!_mode)
+    return;
+  Timers.cancel(_wait);
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK2 &= ~_BV(OCIE2B);
+  *_mode &= ~_mask;
+  _phase = PHASE_IDLE;
+  _busy = false;
+  // 8-bit phase correct PWM at clk/64, as init() sets it
+  TCCR2B = 0;
+  TCCR2A = _BV(WGM20);
+  TCNT2 = 0;
+  OCR2A = 0;
+  OCR2B = 0;
+  TCCR2B = _BV(CS22);
+  SREG = oldSREG;
+  _mode = 0;
+}
+
+/* Sets the next compare interrupt ticks after the last one (the timer
+   restarts from 0 at each match), in pieces if it is longer than the
+   8-bit timer can count. */
+void OneWireMaster::schedule(unsigned int ticks) {
+  if (ticks > 256) {
+    _remaining = ticks - ONEWIRE_CHUNK;
+    ticks = ONEWIRE_CHUNK;
+  } else {
+    _remaining = 0;
+  }
+  OCR2A = ticks - 1;
+  OCR2B = ticks - 1;
+}
+
+/* Starts the engine on a reset (if asked) and then the bits of out and
+   in.  With interrupts off. */
+void OneWireMaster::start(boolean reset, const uint8_t *out, uint8_t out_length,
+                          uint8_t *in, uint8_t in_length) {
+  _out = out;
+  _out_bits = out_length * 8;
+  _in = in;
+  _in_bits = in_length * 8;
+  _bit = 0;
+  _search_step = 0;
+  TCNT2 = 0;
+  if (reset) {
+    *_mode |= _mask;
+    _phase = PHASE_RESET_LOW;
+    schedule(ONEWIRE_TICKS(480));
+  } else {
+    _phase = PHASE_SLOT;
+    schedule(ONEWIRE_TICKS(10));
+  }
+  TIFR2 = _BV(OCF2B);
+  TIMSK2 |= _BV(OCIE2B);
+}
+
+void OneWireMaster::step() {
+  if (_remaining) {
+    schedule(_remaining);
+    return;
+  }
+
+  switch (_phase) {
+    case PHASE_RESET_LOW:
+      // Let go, and look for the presence pulse 70 us later
+      *_mode &= ~_mask;
+      _phase = PHASE_PRESENCE;
+      schedule(ONEWIRE_TICKS(70));
+      break;
+
+    case PHASE_PRESENCE:
+      if (*_in_reg & _mask) {
+        done(ONEWIRE_NO_PRESENCE);
+      } else {
+        // Rest of the 480 us the devices may take over their reply
+        _phase = PHASE_SLOT;
+        schedule(ONEWIRE_TICKS(410));
+      }
+      break;
+
+    case PHASE_ZERO_LOW:
+      // End of a 0: let go, 10 us of recovery
+      *_mode &= ~_mask;
+      _phase = PHASE_SLOT;
+      schedule(ONEWIRE_TICKS(10));
+      break;
+
+    case PHASE_SLOT:
+      slot();
+      break;
+  }
+}
+
+/* Writes one bit.  A 1 is a short low pulse, timed here; the 60 us low of
+   a 0 is left to the timer. */
+static inline void writeBit(volatile uint8_t *mode, uint8_t mask, uint8_t bit) {
+  *mode |= mask;
+  if (bit) {
+    delayMicroseconds(6);
+    *mode &= ~mask;
+  }
+}
+
+/* Reads one bit: a short low pulse, then the device holds the bus low for
+   a 0.  Sampled 15 us into the slot. */
+static inline uint8_t readBit(volatile uint8_t *mode, volatile uint8_t *in, uint8_t mask) {
+  *mode |= mask;
+  delayMicroseconds(6);
+  *mode &= ~mask;
+  delayMicroseconds(9);
+  return (*in & mask) ? 1 : 0;
+}
+
+/* Runs the next bit slot, or ends the operation when there are none */
+void OneWireMaster::slot() {
+  unsigned int bit = _bit;
+  if (bit < _out_bits) {
+    uint8_t value = (_out[bit >> 3] >> (bit & 7)) & 1;
+    writeBit(_mode, _mask, value);
+    if (value) {
+      schedule(ONEWIRE_TICKS(70));
+    } else {
+      _phase = PHASE_ZERO_LOW;
+      schedule(ONEWIRE_TICKS(60));
+    }
+    _bit++;
+  } else if (bit < _out_bits + _in_bits) {
+    bit -= _out_bits;
+    uint8_t mask = 1 << (bit & 7);
+    if (readBit(_mode, _in_reg, _mask))
+      _in[bit >> 3] |= mask;
+    else
+      _in[bit >> 3] &= ~mask;
+    schedule(ONEWIRE_TICKS(70));
+    _bit++;
+  } else if (_job == JOB_SEARCH && bit < _out_bits + 64) {
+    searchSlot();
+  } else {
+    done(ONEWIRE_OK);
+  }
+}
+
+/* One slot of a ROM search.  Each ROM bit takes three: the devices send
+   the bit and its complement, and the master writes the branch to follow,
+   which drops the devices on the other branch.  Where both values are
+   present the branch is picked from the last pass, as in Maxim's
+   application note 187. */
+void OneWireMaster::searchSlot() {
+  uint8_t n = _bit - _out_bits;
+  uint8_t mask = 1 << (n & 7);
+
+  if (_search_step == 0) {
+    _id_bit = readBit(_mode, _in_reg, _mask);
+    _search_step = 1;
+    schedule(ONEWIRE_TICKS(70));
+    return;
+  }
+
+  if (_search_step == 1) {
+    uint8_t complement = readBit(_mode, _in_reg, _mask);
+    schedule(ONEWIRE_TICKS(70));
+    if (_id_bit && complement) {
+      // Nobody answered
+      done(ONEWIRE_NO_PRESENCE);
+      return;
+    }
+    uint8_t direction;
+    if (_id_bit != complement) {
+      direction = _id_bit;
+    } else {
+      if (n + 1 < _last_discrepancy)
+        direction = (_rom[n >> 3] & mask) ? 1 : 0;
+      else
+        direction = n + 1 == _last_discrepancy;
+      if (!direction)
+        _last_zero = n + 1;
+    }
+    if (direction)
+      _rom[n >> 3] |= mask;
+    else
+      _rom[n >> 3] &= ~mask;
+    _id_bit = direction;
+    _search_step = 2;
+    return;
+  }
+
+  writeBit(_mode, _mask, _id_bit);
+  if (_id_bit) {
+    schedule(ONEWIRE_TICKS(70));
+  } else {
+    _phase = PHASE_ZERO_LOW;
+    schedule(ONEWIRE_TICKS(60));
+  }
+  _search_step = 0;
+  _bit++;
+}
+
+static uint8_t crc8(const uint8_t *data, uint8_t length) {
+  uint8_t crc = 0;
+  while (length--)
+    crc = _crc_ibutton_update(crc, *data++);
+  return crc;
+}
+
+/* The engine has finished an operation; works out what the job does
+   next.  In an interrupt. */
+void OneWireMaster::done(uint8_t status) {
+  TIMSK2 &= ~_BV(OCIE2B);
+  *_mode &= ~_mask;
+  _phase = PHASE_IDLE;
+  if (status != ONEWIRE_OK)
+    _errors++;
+
+  switch (_job) {
+    case JOB_SEARCH:
+      if (status != ONEWIRE_OK) {
+        finish(status);
+        return;
+      }
+      // A bad read throws the branch choices off too, so stop there.  A
+      // bus held low reads as all zeros, which passes the CRC, but no
+      // device has family code 0.
+      if (!_rom[0] || crc8(_rom, 7) != _rom[7]) {
+        _errors++;
+        finish(ONEWIRE_CRC);
+        return;
+      }
+      memcpy(_roms[_found++], _rom, 8);
+      _last_discrepancy = _last_zero;
+      if (_last_discrepancy == 0 || _found == _max) {
+        finish(ONEWIRE_OK);
+      } else {
+        _last_zero = 0;
+        start(true, search_command, 1, 0, 0);
+      }
+      return;
+
+    case JOB_CONVERT:
+      if (status != ONEWIRE_OK) {
+        for (_index = 0; _index < _count; _index++)
+          _temp_callback(_index, 0, status);
+        finish(status);
+        return;
+      }
+      // Engine idle and the bus busy until the conversions are done
+      Timers.start(_wait, ONEWIRE_CONVERSION_MS, converted, this);
+      return;
+
+    case JOB_READ:
+      if (status == ONEWIRE_OK && crc8(_scratchpad, 8) != _scratchpad[8]) {
+        status = ONEWIRE_CRC;
+        _errors++;
+      }
+      _temp_callback(_index, status == ONEWIRE_OK ?
+                     (int) (_scratchpad[0] | (_scratchpad[1] << 8)) : 0, status);
+      _index++;
+      readNext();
+      return;
+  }
+  finish(status);
+}
+
+void OneWireMaster::finish(uint8_t status) {
+  _busy = false;
+  if (_callback)
+    _callback(status, _arg);
+}
+
+/* Reads the scratchpad of the next device by ROM code, or ends the job */
+void OneWireMaster::readNext() {
+  if (_index == _count) {
+    finish(ONEWIRE_OK);
+    return;
+  }
+  _command[0] = ROM_MATCH;
+  memcpy(_command + 1, _temp_roms[_index], 8);
+  _command[9] = DS18B20_READ;
+  start(true, _command, 10, _scratchpad, 9);
+}
+
+// Timer callback, in the timer 0 interrupt, when the conversions are done
+void OneWireMaster::converted(void *arg) {
+  OneWireMaster *bus = (OneWireMaster *) arg;
+  bus->_job = JOB_READ;
+  bus->_index = 0;
+  bus->readNext();
+}
+
+int OneWireMaster::transfer(const uint8_t *out, uint8_t out_length, uint8_t *in,
+                            uint8_t in_length, OneWireCallback callback, void *arg) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_busy || !_mode) {
+    SREG = oldSREG;
+    return 1;
+  }
+  _busy = true;
+  _job = JOB_TRANSFER;
+  _callback = callback;
+  _arg = arg;
+  start(true, out, out_length, in, in_length);
+  SREG = oldSREG;
+  return 0;
+}
+
+int OneWireMaster::search(uint8_t (*roms)[8], uint8_t max, OneWireCallback callback,
+                          void *arg) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_busy || !_mode || !max) {
+    SREG = oldSREG;
+    return 1;
+  }
+  _busy = true;
+  _job = JOB_SEARCH;
+  _callback = callback;
+  _arg = arg;
+  _roms = roms;
+  _max = max;
+  _found = 0;
+  _last_discrepancy = 0;
+  _last_zero = 0;
+  start(true, search_command, 1, 0, 0);
+  SREG = oldSREG;
+  return 0;
+}
+
+uint8_t OneWireMaster::found() {
+  return _found;
+}
+
+int OneWireMaster::readTemperatures(const uint8_t (*roms)[8], uint8_t count,
+                                    OneWireTemperatureCallback callback) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_busy || !_mode || !count || !callback) {
+    SREG = oldSREG;
+    return 1;
+  }
+  _busy = true;
+  _job = JOB_CONVERT;
+  _callback = 0;
+  _temp_roms = roms;
+  _count = count;
+  _temp_callback = callback;
+  start(true, convert_command, 2, 0, 0);
+  SREG = oldSREG;
+  return 0;
+}
+
+boolean OneWireMaster::busy() {
+  return _busy;
+}
+
+unsigned int OneWireMaster::errors() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int errors = _errors;
+  SREG = oldSREG;
+  return errors;
+}
@@ -0,0 +1,133 @@
+/*
+  OneWireBus.h - 1-Wire bus master sequenced by Timer2 compare interrupts.
+
+  A 1-Wire bit takes a 70 us slot and a reset close to a millisecond.  Bit
+  banged with delayMicroseconds() that is the whole transfer with the CPU
+  spinning, and interrupts off for most of it.  Here Timer2 runs in CTC
+  mode and its compare interrupt starts each slot: the few microseconds
+  that have to be exact (the low pulse, and for a read, sampling the bus)
+  are done in the interrupt with direct port access, about 15 us with
+  interrupts off per bit, and the rest of the slot and the recovery time
+  are left to the timer.  The reset pulse and the long low of a 0 are
+  timed by the timer too, so a byte costs the CPU about a quarter of the
+  time it takes on the wire.
+
+  Operations run one at a time, each finishing with a callback from the
+  interrupt:
+
+    transfer()  reset, write some bytes, read some bytes
+    search()    find the ROM codes of every device on the bus
+    readTemperatures()
+                start a conversion on every DS18B20 at once (Skip ROM,
+                Convert T), wait 750 ms on a software timer, then read each
+                one's scratchpad by ROM code, checking the CRC, and call
+                back with each temperature as it comes in
+
+    uint8_t roms[16][8];
+    void found(uint8_t status, void *) { ... OneWireBus.found() ... }
+    void temperature(uint8_t index, int temp, uint8_t status) { ... }
+
+    OneWireBus.begin(18);
+    OneWireBus.search(roms, 16, found);
+    ...
+    OneWireBus.readTemperatures(roms, OneWireBus.found(), temperature);
+
+  The bus needs its usual pull-up resistor, and the sensors their own
+  supply: parasite power would need a strong pull-up through conversion,
+  which isn't done.  Timer2 is taken over, from analogWrite() on pins 14
+  and 15 and from tone(); end() gives it back.  Another interrupt longer
+  than about 50 us arriving during the low part of a 0 can stretch it
+  into a reset, so keep interrupt handlers short while the bus is busy.
+*/
+#ifndef OneWireBus_h
+#define OneWireBus_h
+
+#include <inttypes.h>
+#include "Timers.h"
+
+// Operation status
+#define ONEWIRE_OK 0
+#define ONEWIRE_PENDING 1
+#define ONEWIRE_NO_PRESENCE 2
+#define ONEWIRE_CRC 3
+
+#define ONEWIRE_CONVERSION_MS 750
+
+typedef void (*OneWireCallback)(uint8_t status, void *arg);
+// index into the ROM list, temperature in 1/16 degrees C
+typedef void (*OneWireTemperatureCallback)(uint8_t index, int temperature,
+                                           uint8_t status);
+
+class OneWireMaster
+{
+  public:
+    OneWireMaster();
+    void begin(uint8_t pin);
+    void end();
+    // Reset, then write out_length bytes, then read in_length bytes.
+    // Returns 1 if the bus is busy.
+    int transfer(const uint8_t *out, uint8_t out_length, uint8_t *in,
+                 uint8_t in_length, OneWireCallback callback = 0, void *arg = 0);
+    // Fills roms with up to max ROM codes.  found() says how many; on
+    // ONEWIRE_CRC, how many were read before the bad one.
+    int search(uint8_t (*roms)[8], uint8_t max, OneWireCallback callback = 0,
+               void *arg = 0);
+    uint8_t found();
+    // Converts and reads count DS18B20s, calling back once for each
+    int readTemperatures(const uint8_t (*roms)[8], uint8_t count,
+                         OneWireTemperatureCallback callback);
+    boolean busy();
+    // Resets without a presence pulse, and bad CRCs
+    unsigned int errors();
+    // Called from the Timer2 compare interrupt
+    void step();
+  private:
+    void start(boolean reset, const uint8_t *out, uint8_t out_length,
+               uint8_t *in, uint8_t in_length);
+    void schedule(unsigned int ticks);
+    void slot();
+    void searchSlot();
+    void done(uint8_t status);
+    void finish(uint8_t status);
+    void readNext();
+    static void converted(void *arg);
+    // bus pin
+    volatile uint8_t *_mode;
+    volatile uint8_t *_in_reg;
+    uint8_t _mask;
+    // the bit engine
+    uint8_t _phase;
+    unsigned int _remaining;
+    const uint8_t *_out;
+    uint8_t *_in;
+    unsigned int _out_bits;
+    unsigned int _in_bits;
+    unsigned int _bit;
+    // what the engine is doing it for
+    uint8_t _job;
+    volatile boolean _busy;
+    OneWireCallback _callback;
+    void *_arg;
+    // search
+    uint8_t (*_roms)[8];
+    uint8_t _max;
+    uint8_t _found;
+    uint8_t _rom[8];
+    uint8_t _last_discrepancy;
+    uint8_t _last_zero;
+    uint8_t _search_step;
+    uint8_t _id_bit;
+    // temperatures
+    const uint8_t (*_temp_roms)[8];
+    uint8_t _count;
+    uint8_t _index;
+    OneWireTemperatureCallback _temp_callback;
+    uint8_t _command[10];
+    uint8_t _scratchpad[9];
+    Timer _wait;
+    volatile unsigned int _errors;
+};
+
+extern OneWireMaster OneWireBus;
+
+#endif
@@ -22,13 +22,117 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdarg.h>
 #include <math.h>
+#include <avr/pgmspace.h>
 #include "wiring.h"
 
 #include "Print.h"
 
+// Number Formatting ///////////////////////////////////////////////////////////
+
+// Powers of ten for scaling fractions, kept in flash.
+static const uint32_t PROGMEM power_of_ten_PGM[] =
+{
+  1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL,
+  100000000UL, 1000000000UL
+};
+
+#define powerOfTen(n) pgm_read_dword(power_of_ten_PGM + (n))
+
+/* Divides by ten with shifts and adds instead of a libgcc __udivmodsi4
+   call.  q is an underestimate of n / 10 by at most one, which the
+   remainder check corrects (Hacker's Delight, divu10). */
+static inline uint32_t divmod10(uint32_t n, uint8_t *rem)
+{
+  uint32_t q = (n >> 1) + (n >> 2);
+  q += q >> 4;
+  q += q >> 8;
+  q += q >> 16;
+  q >>= 3;
+  uint8_t r = n - ((q << 3) + (q << 1));
+  if (r > 9) {
+    q++;
+    r -= 10;
+  }
+  *rem = r;
+  return q;
+}
+
+// Same as divmod10 once the value fits in 16 bits, which is cheaper still.
+static inline uint16_t divmod10_16(uint16_t n, uint8_t *rem)
+{
+  uint16_t q = (n >> 1) + (n >> 2);
+  q += q >> 4;
+  q += q >> 8;
+  q >>= 3;
+  uint8_t r = n - ((q << 3) + (q << 1));
+  if (r > 9) {
+    q++;
+    r -= 10;
+  }
+  *rem = r;
+  return q;
+}
+
+/* Writes the digits of n right to left ending just before end, and returns
+   a pointer to the first one.  Base 10 uses the divide-free path above,
+   power-of-two bases are shifts and masks, and anything else falls back
+   to a real division. */
+static uint8_t *formatNumber(uint8_t *end, unsigned long n, uint8_t base)
+{
+  uint8_t *p = end;
+  uint8_t digit;
+
+  if (base == 10) {
+    while (n > 0xFFFF) {
+      n = divmod10(n, &digit);
+      *--p = '0' + digit;
+    }
+    uint16_t m = n;
+    do {
+      m = divmod10_16(m, &digit);
+      *--p = '0' + digit;
+    } while (m > 0);
+  } else if ((base & (base - 1)) == 0) {
+    uint8_t shift = 0;
+    while ((1 << shift) < base)
+      shift++;
+    do {
+      digit = n & (base - 1);
+      n >>= shift;
+      *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while (n > 0);
+  } else {
+    do {
+      digit = n % base;
+      n /= base;
+      *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while (n > 0);
+  }
+  return p;
+}
+
+// Writes n as exactly width digits, zero padded, ending just before end.
+static uint8_t *formatFraction(uint8_t *end, unsigned long n, uint8_t width)
+{
+  uint8_t *p = formatNumber(end, n, 10);
+  while (p > end - width)
+    *--p = '0';
+  return p;
+}
+
 // Public Methods //////////////////////////////////////////////////////////////
 
+/* Default bulk write, one byte at a time.  Everything in this class funnels
+   through here so that a subclass only has to override this to speed up all
+   of print() and println(). */
+void Print::write(const uint8_t *buffer, size_t size)
+{
+  while (size--)
+    write(*buffer++);
+}
+
 void Print::print(uint8_t b)
 {
   this->write(b);
@@ -41,8 +145,24 @@ void Print::print(char c)
 
 void Print::print(const char c[])
 {
-  while (*c)
-    print(*c++);
+  write((const uint8_t *) c, strlen(c));
+}
+
+void Print::print(const __FlashStringHelper *s)
+{
+  const char *p = reinterpret_cast<const char *>(s);
+  uint8_t buf[16];
+  uint8_t len;
+
+  // Stream out of flash a chunk at a time
+  do {
+    for (len = 0; len < sizeof(buf); len++) {
+      buf[len] = pgm_read_byte(p++);
+      if (buf[len] == 0)
+        break;
+    }
+    write(buf, len);
+  } while (len == sizeof(buf));
 }
 
 void Print::print(int n)
@@ -57,11 +177,10 @@ void Print::print(unsigned int n)
 
 void Print::print(long n)
 {
-  if (n < 0) {
-    print('-');
-    n = -n;
-  }
-  printNumber(n, 10);
+  if (n < 0)
+    printNumber(-(unsigned long) n, 10, true);
+  else
+    printNumber(n, 10);
 }
 
 void Print::print(unsigned long n)
@@ -84,10 +203,74 @@ void Print::print(double n)
   printFloat(n, 2);
 }
 
+void Print::print(const Fixed &f)
+{
+  uint8_t buf[24];
+  uint8_t *end = buf + sizeof(buf);
+  uint8_t *p = end;
+  bool negative = f.raw < 0;
+  unsigned long n = negative ? -(unsigned long) f.raw : f.raw;
+  uint8_t fracBits = f.fracBits > 31 ? 31 : f.fracBits;
+  uint8_t digits = f.digits > 4 ? 4 : f.digits;
+  unsigned long int_part = n >> fracBits;
+  unsigned long frac = n & ((1UL << fracBits) - 1);
+
+  // Keep at most 16 fraction bits so frac * 10^4 stays within 32 bits;
+  // that is still finer than the four decimal places we print.
+  if (fracBits > 16) {
+    frac >>= fracBits - 16;
+    fracBits = 16;
+  }
+
+  if (digits > 0) {
+    // Scale to decimal places, rounding to nearest on the dropped bits
+    unsigned long scale = powerOfTen(digits);
+    unsigned long dec = frac * scale;
+    if (fracBits > 0)
+      dec = (dec + (1UL << (fracBits - 1))) >> fracBits;
+    if (dec >= scale) {
+      int_part++;
+      dec -= scale;
+    }
+    p = formatFraction(p, dec, digits);
+    *--p = '.';
+  } else if (fracBits > 0 && (frac >> (fracBits - 1))) {
+    int_part++;
+  }
+
+  p = formatNumber(p, int_part, 10);
+  if (negative)
+    *--p = '-';
+  write(p, end - p);
+}
+
+void Print::print(const Decimal &d)
+{
+  uint8_t buf[24];
+  uint8_t *end = buf + sizeof(buf);
+  bool negative = d.raw < 0;
+  unsigned long n = negative ? -(unsigned long) d.raw : d.raw;
+  uint8_t places = d.places > 9 ? 9 : d.places;
+
+  // Format all the digits with enough leading zeros for a whole part, then
+  // slide the whole part left one place to open a gap for the point.
+  uint8_t *p = formatFraction(end, n, places + 1);
+  if (places > 0) {
+    uint8_t *point = end - places;
+    for (uint8_t *q = p; q < point; q++)
+      q[-1] = q[0];
+    p--;
+    point[-1] = '.';
+  }
+  if (negative)
+    *--p = '-';
+  write(p, end - p);
+}
+
 void Print::println(void)
 {
-  print('\r');
-  print('\n');  
+  static const uint8_t crlf[2] = { '\r', '\n' };
+  write(crlf, sizeof(crlf));
 }
 
 void Print::println(char c)
@@ -102,6 +285,12 @@ void Print::println(const char c[])
   println();
 }
 
+void Print::println(const __FlashStringHelper *s)
+{
+  print(s);
+  println();
+}
+
 void Print::println(uint8_t b)
 {
   print(b);
@@ -144,60 +333,237 @@ void Print::println(double n)
   println();
 }
 
-// Private Methods /////////////////////////////////////////////////////////////
+void Print::println(const Fixed &f)
+{
+  print(f);
+  println();
+}
 
-void Print::printNumber(unsigned long n, uint8_t base)
+void Print::println(const Decimal &d)
 {
-  unsigned char buf[8 * sizeof(long)]; // Assumes 8-bit chars. 
-  unsigned long i = 0;
+  print(d);
+  println();
+}
 
-  if (n == 0) {
-    print('0');
-    return;
-  } 
+void Print::printf_P(const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vprintf_P(format, ap);
+  va_end(ap);
+}
 
-  while (n > 0) {
-    buf[i++] = n % base;
-    n /= base;
-  }
+void Print::printf(const __FlashStringHelper *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vprintf_P(reinterpret_cast<const char *>(format), ap);
+  va_end(ap);
+}
+
+// Private Methods /////////////////////////////////////////////////////////////
+
+void Print::printNumber(unsigned long n, uint8_t base, bool negative)
+{
+  uint8_t buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars, plus a sign.
+  uint8_t *end = buf + sizeof(buf);
+
+  if (base < 2)
+    base = 10;
+  uint8_t *p = formatNumber(end, n, base);
+  if (negative)
+    *--p = '-';
+  write(p, end - p);
+}
 
-  for (; i > 0; i--)
-    print((char) (buf[i - 1] < 10 ?
-      '0' + buf[i - 1] :
-      'A' + buf[i - 1] - 10));
+/* Collects formatter output so it reaches write() in chunks rather than a
+   character at a time. */
+class FormatBuffer
+{
+  public:
+    FormatBuffer(Print *out) : _out(out), _len(0) {}
+    void put(uint8_t c)
+    {
+      if (_len == sizeof(_buf))
+        flush();
+      _buf[_len++] = c;
+    }
+    // Longer runs skip the buffer and go straight to write()
+    void put(const uint8_t *p, size_t n)
+    {
+      if (n > sizeof(_buf) - _len) {
+        flush();
+        _out->write(p, n);
+      } else {
+        while (n--)
+          _buf[_len++] = *p++;
+      }
+    }
+    void pad(uint8_t c, uint8_t count)
+    {
+      while (count--)
+        put(c);
+    }
+    void flush()
+    {
+      if (_len)
+        _out->write(_buf, _len);
+      _len = 0;
+    }
+  private:
+    Print *_out;
+    uint8_t _len;
+    uint8_t _buf[16];
+};
+
+void Print::vprintf_P(const char *format, va_list ap)
+{
+  FormatBuffer out(this);
+  uint8_t num[8 * sizeof(long) + 1];
+  uint8_t *end = num + sizeof(num);
+  char c;
+
+  while ((c = pgm_read_byte(format++)) != 0) {
+    if (c != '%') {
+      out.put(c);
+      continue;
+    }
+
+    bool left = false, zero = false, is_long = false;
+    uint8_t width = 0;
+
+    // Flags, width and length modifier
+    c = pgm_read_byte(format++);
+    for (;; c = pgm_read_byte(format++)) {
+      if (c == '-')
+        left = true;
+      else if (c == '0')
+        zero = true;
+      else
+        break;
+    }
+    while (c >= '0' && c <= '9') {
+      width = width * 10 + (c - '0');
+      c = pgm_read_byte(format++);
+    }
+    if (c == 'l') {
+      is_long = true;
+      c = pgm_read_byte(format++);
+    }
+
+    const uint8_t *text = 0;   // RAM text to emit, or
+    const char *flash = 0;     // flash text to emit
+    size_t len = 0;
+    bool negative = false;
+    uint8_t base = 0;
+
+    switch (c) {
+      case 'd':
+      case 'i': {
+        long n = is_long ? va_arg(ap, long) : va_arg(ap, int);
+        negative = n < 0;
+        text = formatNumber(end, negative ? -(unsigned long) n : n, 10);
+        len = end - text;
+        break;
+      }
+      case 'u': base = 10; break;
+      case 'x':
+      case 'X': base = 16; break;
+      case 'o': base = 8; break;
+      case 'b': base = 2; break;
+      case 'c':
+        num[0] = va_arg(ap, int);
+        text = num;
+        len = 1;
+        break;
+      case 's':
+        text = va_arg(ap, const uint8_t *);
+        len = strlen((const char *) text);
+        break;
+      case 'S':
+        flash = va_arg(ap, const char *);
+        len = strlen_P(flash);
+        break;
+      case '%':
+        out.put('%');
+        continue;
+      case 0:
+        // Format ended in the middle of a conversion
+        format--;
+        continue;
+      default:
+        continue;
+    }
+
+    if (base) {
+      unsigned long n = is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+      text = formatNumber(end, n, base);
+      if (c == 'x') {
+        for (uint8_t *p = (uint8_t *) text; p < end; p++)
+          if (*p >= 'A')
+            *p += 'a' - 'A';
+      }
+      len = end - text;
+    }
+
+    uint8_t fill = width > len + negative ? width - len - negative : 0;
+    if (!left && !zero)
+      out.pad(' ', fill);
+    if (negative)
+      out.put('-');
+    if (!left && zero)
+      out.pad('0', fill);
+    if (flash) {
+      while (len--)
+        out.put(pgm_read_byte(flash++));
+    } else {
+      out.put(text, len);
+    }
+    if (left)
+      out.pad(' ', fill);
+  }
+  out.flush();
 }
 
+/* Prints a double with the given number of decimal places (at most 9).
+   The only floating point work is one conversion for the whole part and
+   one multiply to scale the fraction to an integer; the digits themselves
+   come from the integer formatter. */
 void Print::printFloat(double number, uint8_t digits) 
 { 
+  uint8_t buf[24];
+  uint8_t *end = buf + sizeof(buf);
+  uint8_t *p = end;
+  bool negative = false;
+
   // Handle negative numbers
   if (number < 0.0)
   {
-     print('-');
+     negative = true;
      number = -number;
   }
 
-  // Round correctly so that print(1.999, 2) prints as "2.00"
-  double rounding = 0.5;
-  for (uint8_t i=0; i<digits; ++i)
-    rounding /= 10.0;
-  
-  number += rounding;
+  if (digits > 9)
+    digits = 9;
 
-  // Extract the integer part of the number and print it
+  // Extract the integer part of the number, then scale what's left so the
+  // digits we want are whole.  Round correctly so that print(1.999, 2)
+  // prints as "2.00".
   unsigned long int_part = (unsigned long)number;
-  double remainder = number - (double)int_part;
-  print(int_part);
+  unsigned long scale = powerOfTen(digits);
+  unsigned long frac = (unsigned long)((number - (double)int_part) * scale + 0.5);
+  if (frac >= scale) {
+    int_part++;
+    frac -= scale;
+  }
 
   // Print the decimal point, but only if there are digits beyond
-  if (digits > 0)
-    print("."); 
-
-  // Extract digits from the remainder one at a time
-  while (digits-- > 0)
-  {
-    remainder *= 10.0;
-    int toPrint = int(remainder);
-    print(toPrint);
-    remainder -= toPrint; 
-  } 
+  if (digits > 0) {
+    p = formatFraction(p, frac, digits);
+    *--p = '.';
+  }
+  p = formatNumber(p, int_part, 10);
+  if (negative)
+    *--p = '-';
+  write(p, end - p);
 }
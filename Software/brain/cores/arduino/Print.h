@@ -21,6 +21,9 @@
 #define Print_h
 
 #include <inttypes.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <avr/pgmspace.h>
 
 #define DEC 10
 #define HEX 16
@@ -28,15 +31,45 @@
 #define BIN 2
 #define BYTE 0
 
+// Marks a string literal that lives in flash.  Serial.print(F("hello"))
+// streams it straight out of program memory instead of copying it into
+// SRAM at startup the way a plain literal is.
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+// Binary fixed-point value for print(): prints raw / 2^fracBits with the
+// given number of decimal places (at most 4), without touching floats.
+struct Fixed
+{
+  Fixed(long r, uint8_t f, uint8_t d = 2) : raw(r), fracBits(f), digits(d) {}
+  long raw;
+  uint8_t fracBits;
+  uint8_t digits;
+};
+
+// Decimal fixed-point value for print(): prints raw / 10^places, so a
+// reading kept in millivolts prints as volts with Decimal(mv, 3).
+struct Decimal
+{
+  Decimal(long r, uint8_t p) : raw(r), places(p) {}
+  long raw;
+  uint8_t places;
+};
+
 class Print
 {
   private:
-    void printNumber(unsigned long, uint8_t);
+    void printNumber(unsigned long, uint8_t, bool negative = false);
     void printFloat(double, uint8_t);
+    void vprintf_P(const char *, va_list);
   public:
     virtual void write(uint8_t);
+    // Writes a whole buffer.  The default just loops over write(uint8_t);
+    // subclasses that can move a chunk at a time should override it.
+    virtual void write(const uint8_t *buffer, size_t size);
     void print(char);
     void print(const char[]);
+    void print(const __FlashStringHelper *);
     void print(uint8_t);
     void print(int);
     void print(unsigned int);
@@ -44,9 +77,12 @@ class Print
     void print(unsigned long);
     void print(long, int);
     void print(double);
+    void print(const Fixed &);
+    void print(const Decimal &);
     void println(void);
     void println(char);
     void println(const char[]);
+    void println(const __FlashStringHelper *);
     void println(uint8_t);
     void println(int);
     void println(unsigned int);
@@ -54,6 +90,13 @@ class Print
     void println(unsigned long);
     void println(long, int);
     void println(double);
+    void println(const Fixed &);
+    void println(const Decimal &);
+    // Compact printf with the format string in flash.  Understands the
+    // flags '-' and '0', a field width, the 'l' length modifier and
+    // %d %i %u %x %X %o %b %c %s %S (a flash string) and %%.
+    void printf_P(const char *format, ...);
+    void printf(const __FlashStringHelper *format, ...);
 };
 
 #endif
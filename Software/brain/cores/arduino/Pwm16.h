@@ -0,0 +1,86 @@
+/*
+  Pwm16.h - Timer1 PWM at any frequency with up to 16 bits of duty.
+
+  analogWrite() runs Timer1 as init() leaves it: 8-bit phase correct PWM
+  at clk/64, about 610 Hz at 20 MHz.  pwm16Begin() reprograms Timer1 to
+  count to a TOP in ICR1 worked out from the frequency asked for, so a
+  motor or fan can run above the audible range with as much resolution as
+  the clock allows: TOP + 1 steps, 501 at 20 kHz in PWM_CENTER mode and
+  1000 in PWM_EDGE.
+
+    pwm16Begin(20000, PWM_CENTER);
+    pwm16Connect(13);
+    pwm16WriteA(pwm16Top() / 4);     // 25% on pin 13
+
+  The duty is in timer counts, 0 (off) to pwm16Top() (fully on);
+  pwm16Scale() maps 0-65535 onto that.  The compare registers are double
+  buffered by the hardware and only take a new value at the end of a
+  period, so a duty change never gives a short or stretched pulse.
+  pwm16WriteA() and pwm16WriteB() (pins 13 and 12) are inline: one 16-bit
+  register write with interrupts held off, since an interrupt touching
+  another 16-bit Timer1 register part way through would corrupt it.
+
+  PWM_CENTER is phase and frequency correct PWM.  The pulses are centred
+  on BOTTOM, where the overflow flag is set, which is what
+  AnalogScan.syncToPwm() triggers on.  PWM_EDGE is fast PWM, with twice
+  the resolution for a given frequency; its overflow comes at the start of
+  each pulse.
+
+  Timer1 is shared: analogWrite() on pins 12 and 13 writes a duty relative
+  to the new TOP, and tone() on Timer1 reprograms it.  pwm16End() goes
+  back to the init() settings.
+*/
+#ifndef Pwm16_h
+#define Pwm16_h
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define PWM_CENTER 0
+#define PWM_EDGE 1
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern unsigned int pwm16_top;
+
+unsigned long pwm16Begin(unsigned long frequency, uint8_t mode);
+void pwm16End(void);
+void pwm16Connect(uint8_t pin);
+void pwm16Disconnect(uint8_t pin);
+void pwm16Write(uint8_t pin, unsigned int duty);
+
+static inline unsigned int pwm16Top(void)
+{
+	return pwm16_top;
+}
+
+// Duty from 0 to 65535, full scale, to timer counts
+static inline unsigned int pwm16Scale(unsigned int duty)
+{
+	return ((unsigned long) duty * (pwm16_top + 1)) >> 16;
+}
+
+static inline void pwm16WriteA(unsigned int duty)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	OCR1A = duty;
+	SREG = oldSREG;
+}
+
+static inline void pwm16WriteB(unsigned int duty)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	OCR1B = duty;
+	SREG = oldSREG;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
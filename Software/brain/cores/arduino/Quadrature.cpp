@@ -0,0 +1,148 @@
+/*
+  Quadrature.cpp - Quadrature encoder decoding on pin change interrupts.
+  See Quadrature.h for how to use it.
+*/
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "pins_arduino.h"
+#include "Quadrature.h"
+
+// Marks a transition where both channels changed
+#define QUADRATURE_ILLEGAL 2
+
+/* Indexed by (old state << 2) | new state, where a state is (A << 1) | B.
+   Forward runs 00, 10, 11, 01. */
+static const int8_t PROGMEM quadrature_table[16] = {
+   0, -1, +1,  2,
+  +1,  0,  2, -1,
+  -1,  2,  0, +1,
+   2, +1, -1,  0
+};
+
+// The pin change service calls plain functions, so each running encoder
+// gets one of these to find its way back to the object
+static QuadratureEncoder *encoders[QUADRATURE_ENCODERS];
+
+static void quadratureEdge0() {
+  encoders[0]->edge();
+}
+
+static void quadratureEdge1() {
+  encoders[1]->edge();
+}
+
+static void (*const quadrature_edges[QUADRATURE_ENCODERS])(void) = {
+  quadratureEdge0,
+  quadratureEdge1
+};
+
+QuadratureEncoder::QuadratureEncoder() {
+  _slot = QUADRATURE_ENCODERS;
+  _state = 0;
+  _position = 0;
+  _last_position = 0;
+  _velocity = 0;
+  _errors = 0;
+  _sample_ms = QUADRATURE_VELOCITY_MS;
+}
+
+int QuadratureEncoder::begin(uint8_t a, uint8_t b, unsigned int sample_ms) {
+  if (_slot < QUADRATURE_ENCODERS)
+    end();
+  uint8_t slot = 0;
+  while (slot < QUADRATURE_ENCODERS && encoders[slot])
+    slot++;
+  if (slot == QUADRATURE_ENCODERS)
+    return 1;
+
+  _pin_a = a;
+  _pin_b = b;
+  _in_a = portInputRegister(digitalPinToPort(a));
+  _in_b = portInputRegister(digitalPinToPort(b));
+  _mask_a = digitalPinToBitMask(a);
+  _mask_b = digitalPinToBitMask(b);
+  pinMode(a, INPUT);
+  pinMode(b, INPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  _slot = slot;
+  encoders[slot] = this;
+  _state = ((*_in_a & _mask_a) ? 2 : 0) | ((*_in_b & _mask_b) ? 1 : 0);
+  _position = 0;
+  _last_position = 0;
+  _velocity = 0;
+  _errors = 0;
+  SREG = oldSREG;
+
+  _sample_ms = sample_ms ? sample_ms : 1;
+  attachPinChangeInterrupt(a, quadrature_edges[slot], CHANGE);
+  attachPinChangeInterrupt(b, quadrature_edges[slot], CHANGE);
+  Timers.start(_timer, _sample_ms, sample, this, TIMER_PERIODIC);
+  return 0;
+}
+
+void QuadratureEncoder::end() {
+  if (_slot >= QUADRATURE_ENCODERS)
+    return;
+  Timers.cancel(_timer);
+  detachPinChangeInterrupt(_pin_a);
+  detachPinChangeInterrupt(_pin_b);
+  uint8_t oldSREG = SREG;
+  cli();
+  encoders[_slot] = 0;
+  _slot = QUADRATURE_ENCODERS;
+  _velocity = 0;
+  SREG = oldSREG;
+}
+
+void QuadratureEncoder::edge() {
+  uint8_t state = ((*_in_a & _mask_a) ? 2 : 0) | ((*_in_b & _mask_b) ? 1 : 0);
+  int8_t step = pgm_read_byte(&quadrature_table[(_state << 2) | state]);
+  _state = state;
+  if (step == QUADRATURE_ILLEGAL)
+    _errors++;
+  else
+    _position += step;
+}
+
+// Timer callback, in the timer 0 interrupt
+void QuadratureEncoder::sample(void *arg) {
+  QuadratureEncoder *encoder = (QuadratureEncoder *) arg;
+  long position = encoder->_position;
+  encoder->_velocity = (position - encoder->_last_position) * 1000 / (long) encoder->_sample_ms;
+  encoder->_last_position = position;
+}
+
+long QuadratureEncoder::position() {
+  uint8_t oldSREG = SREG;
+  cli();
+  long position = _position;
+  SREG = oldSREG;
+  return position;
+}
+
+void QuadratureEncoder::write(long position) {
+  uint8_t oldSREG = SREG;
+  cli();
+  // Move the velocity reference too, so the jump doesn't show as speed
+  _last_position += position - _position;
+  _position = position;
+  SREG = oldSREG;
+}
+
+long QuadratureEncoder::velocity() {
+  uint8_t oldSREG = SREG;
+  cli();
+  long velocity = _velocity;
+  SREG = oldSREG;
+  return velocity;
+}
+
+unsigned int QuadratureEncoder::errors() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int errors = _errors;
+  SREG = oldSREG;
+  return errors;
+}
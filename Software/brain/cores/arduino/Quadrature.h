@@ -0,0 +1,71 @@
+/*
+  Quadrature.h - Quadrature encoder decoding on pin change interrupts.
+
+  Each encoder has two channels, A and B, a quarter cycle apart; the order
+  they change in gives the direction.  Both pins are put on the pin change
+  service with CHANGE, and each interrupt reads the two pins straight from
+  their port registers and looks the old and new state up in a 16 entry
+  table: +1, -1, no change, or an illegal jump where both channels moved
+  at once.  Illegal jumps mean edges were missed (or the wiring is noisy)
+  and are counted in errors() rather than guessed at.
+
+  Every edge of either channel counts, so the position is in quarter
+  cycles: a 100 line encoder gives 400 counts a turn.  Forward is A
+  leading B.  The pins can be on any ports, and two encoders can share a
+  port.  Per edge the cost is the pin change interrupt plus the decode,
+  roughly 150 cycles, so at 20 MHz edge rates of several tens of kHz are
+  fine as long as other interrupts are short.
+
+    QuadratureEncoder steering;
+    steering.begin(16, 17);
+    ...
+    long where = steering.position();
+    long speed = steering.velocity();   // counts a second
+
+  The velocity is the change in position over each sample period, worked
+  out by a software timer on the Timers wheel.
+*/
+#ifndef Quadrature_h
+#define Quadrature_h
+
+#include <inttypes.h>
+#include "Timers.h"
+
+#define QUADRATURE_ENCODERS 2
+#define QUADRATURE_VELOCITY_MS 10
+
+class QuadratureEncoder
+{
+  public:
+    QuadratureEncoder();
+    // Starts decoding on pins a and b, with the velocity measured over
+    // sample_ms.  Returns 1 if QUADRATURE_ENCODERS are already running.
+    int begin(uint8_t a, uint8_t b, unsigned int sample_ms = QUADRATURE_VELOCITY_MS);
+    void end();
+    long position();
+    void write(long position);
+    // Counts a second over the last sample period, negative for reverse
+    long velocity();
+    // Illegal transitions seen since begin()
+    unsigned int errors();
+    // Called from the pin change interrupt
+    void edge();
+  private:
+    static void sample(void *arg);
+    uint8_t _pin_a;
+    uint8_t _pin_b;
+    volatile uint8_t *_in_a;
+    volatile uint8_t *_in_b;
+    uint8_t _mask_a;
+    uint8_t _mask_b;
+    uint8_t _slot;
+    uint8_t _state;
+    volatile long _position;
+    long _last_position;
+    volatile long _velocity;
+    volatile unsigned int _errors;
+    unsigned int _sample_ms;
+    Timer _timer;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+  Scheduler.cpp - Cooperative run-to-completion scheduler.
+  See Scheduler.h for how to use it.
+*/
+#include "WProgram.h"
+#include "Scheduler.h"
+
+TaskScheduler Scheduler;
+
+Task::Task(TaskFunction function, uint8_t priority) {
+  _function = function;
+  _priority = priority;
+  _bit = 0;
+  _head = 0;
+  _count = 0;
+  _period_event = 0;
+  _runs = 0;
+  _ticks = 0;
+  _max_ticks = 0;
+  _overruns = 0;
+}
+
+uint8_t Task::priority() {
+  return _priority;
+}
+
+uint8_t Task::pending() {
+  return _count;
+}
+
+unsigned long Task::runs() {
+  return _runs;
+}
+
+unsigned long Task::ticks() {
+  return _ticks;
+}
+
+unsigned long Task::maxTicks() {
+  return _max_ticks;
+}
+
+unsigned int Task::overruns() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int overruns = _overruns;
+  SREG = oldSREG;
+  return overruns;
+}
+
+void Task::resetStats() {
+  uint8_t oldSREG = SREG;
+  cli();
+  _runs = 0;
+  _ticks = 0;
+  _max_ticks = 0;
+  _overruns = 0;
+  SREG = oldSREG;
+}
+
+// Timer callback for every(), in the timer interrupt
+void Task::release(void *arg) {
+  Task *task = (Task *) arg;
+  if (task->_count)
+    task->_overruns++;
+  else
+    Scheduler.post(*task, task->_period_event);
+}
+
+TaskScheduler::TaskScheduler() {
+  _count = 0;
+  _ready = 0;
+}
+
+int TaskScheduler::add(Task &task) {
+  if (_count == SCHEDULER_MAX_TASKS || task._bit)
+    return 1;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  // Insert after every task of the same or more urgent priority, shifting
+  // the rest (and their ready bits) up one
+  uint8_t i = _count;
+  uint8_t ready = _ready;
+  while (i > 0 && _tasks[i - 1]->_priority > task._priority) {
+    _tasks[i] = _tasks[i - 1];
+    _tasks[i]->_bit <<= 1;
+    i--;
+  }
+  uint8_t below = (1 << i) - 1;
+  _ready = (ready & below) | ((ready & ~below) << 1);
+  _tasks[i] = &task;
+  task._bit = 1 << i;
+  if (task._count)
+    _ready |= task._bit;
+  _count++;
+  SREG = oldSREG;
+  return 0;
+}
+
+int TaskScheduler::post(Task &task, unsigned int event) {
+  // Not added, so run() would never get to it
+  if (!task._bit)
+    return 1;
+  uint8_t oldSREG = SREG;
+  cli();
+  if (task._count == TASK_QUEUE_SIZE) {
+    task._overruns++;
+    SREG = oldSREG;
+    return 1;
+  }
+  task._events[(task._head + task._count) % TASK_QUEUE_SIZE] = event;
+  task._count++;
+  _ready |= task._bit;
+  SREG = oldSREG;
+  return 0;
+}
+
+void TaskScheduler::every(Task &task, unsigned long ms, unsigned int event) {
+  task._period_event = event;
+  Timers.start(task._timer, ms, Task::release, &task, TIMER_PERIODIC);
+}
+
+void TaskScheduler::stop(Task &task) {
+  Timers.cancel(task._timer);
+}
+
+void TaskScheduler::run() {
+  for (;;) {
+    uint8_t oldSREG = SREG;
+    cli();
+    uint8_t ready = _ready;
+    if (!ready) {
+      SREG = oldSREG;
+      return;
+    }
+    uint8_t i = 0;
+    while (!(ready & 1)) {
+      ready >>= 1;
+      i++;
+    }
+    Task *task = _tasks[i];
+    unsigned int event = task->_events[task->_head];
+    task->_head = (task->_head + 1) % TASK_QUEUE_SIZE;
+    if (!--task->_count)
+      _ready &= ~task->_bit;
+    SREG = oldSREG;
+
+    unsigned long start = timerTicks();
+    task->_function(event);
+    unsigned long elapsed = timerTicks() - start;
+
+    task->_runs++;
+    task->_ticks += elapsed;
+    if (elapsed > task->_max_ticks)
+      task->_max_ticks = elapsed;
+  }
+}
+
+void TaskScheduler::idle() {
+  uint8_t oldSREG = SREG;
+  cli();
+  // An event posted after this check wakes the sleep straight away
+  if (!_ready)
+    ::idle();
+  SREG = oldSREG;
+}
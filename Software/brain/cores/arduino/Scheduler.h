@@ -0,0 +1,106 @@
+/*
+  Scheduler.h - Optional cooperative scheduler: prioritized run-to-completion
+  tasks fed by event queues.
+
+  A Task is a function and a priority (0 is the most urgent).  Interrupt
+  handlers and other tasks post events to it; each event is one call of the
+  function, which runs to completion before anything else is dispatched.
+  Scheduler.run() always picks the most urgent task with an event waiting,
+  so a long low priority job (printing a report, say) only ever delays a
+  control task by the length of one call, never by a whole loop().
+
+  The scheduler is only linked in if the sketch uses it.  Sketches that
+  just define loop() are unaffected; to use it, register tasks in setup()
+  and call Scheduler.run() from loop().  Anything else in loop() then runs
+  in the gaps, below every task.
+
+    Task control(controlStep, 0);
+    Task logger(logStep, 3);
+    void onFrame(CanMessage &msg) { Scheduler.post(logger, msg.id); }
+    void setup() {
+      Scheduler.add(control);
+      Scheduler.add(logger);
+      Scheduler.every(control, 10);
+      Can.attach(onFrame);
+    }
+    void loop() { Scheduler.run(); Scheduler.idle(); }
+
+  Scheduler.idle() is optional: without it loop() spins as before.
+  post() is safe from interrupts.  Each task keeps runs(), the total and
+  worst case time spent in it (in timerTicks(), 3.2 us each at 20 MHz), and
+  overruns(): events dropped because its queue was full, plus periodic
+  releases that came round while the previous one was still waiting.
+*/
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#include <inttypes.h>
+#include "Timers.h"
+
+#define SCHEDULER_MAX_TASKS 8
+#define TASK_QUEUE_SIZE 4
+
+typedef void (*TaskFunction)(unsigned int event);
+
+class Task
+{
+  public:
+    Task(TaskFunction function, uint8_t priority);
+    uint8_t priority();
+    // Events waiting to be run
+    uint8_t pending();
+    unsigned long runs();
+    // Time spent in the task function, in timerTicks()
+    unsigned long ticks();
+    unsigned long maxTicks();
+    unsigned int overruns();
+    void resetStats();
+  private:
+    friend class TaskScheduler;
+    static void release(void *task);
+    TaskFunction _function;
+    uint8_t _priority;
+    uint8_t _bit;
+    unsigned int _events[TASK_QUEUE_SIZE];
+    uint8_t _head;
+    volatile uint8_t _count;
+    unsigned int _period_event;
+    Timer _timer;
+    unsigned long _runs;
+    unsigned long _ticks;
+    unsigned long _max_ticks;
+    volatile unsigned int _overruns;
+};
+
+class TaskScheduler
+{
+  public:
+    TaskScheduler();
+    // Registers a task.  Returns 1 if it is already registered or
+    // SCHEDULER_MAX_TASKS are.
+    int add(Task &task);
+    // Queues an event for the task.  Returns 1 if the task was never
+    // added, or (counting an overrun) if its queue is full.  Safe to call
+    // from an interrupt.
+    int post(Task &task, unsigned int event = 0);
+    // Posts event to the task every ms milliseconds, from the timer
+    // interrupt.  A release is skipped, and counted as an overrun, if the
+    // task still has events waiting.
+    void every(Task &task, unsigned long ms, unsigned int event = 0);
+    void stop(Task &task);
+    // Runs tasks, most urgent first, until none has an event waiting
+    void run();
+    // Sleeps in idle() until the next interrupt if no task has an event
+    // waiting.  Call after run() to stop loop() spinning.
+    void idle();
+  private:
+    Task *_tasks[SCHEDULER_MAX_TASKS];
+    uint8_t _count;
+    // bit n set when _tasks[n] has events; the tasks are kept in priority
+    // order so the lowest set bit is the task to run
+    volatile uint8_t _ready;
+};
+
+extern TaskScheduler Scheduler;
+
+#endif
@@ -0,0 +1,282 @@
+/*
+  SlcanGateway.cpp - CAN to serial gateway speaking the SLCAN protocol.
+  See SlcanGateway.h for the supported commands.
+*/
+#include "WProgram.h"
+#include "SlcanGateway.h"
+#include <avr/pgmspace.h>
+
+#define SLCAN_OK '\r'
+#define SLCAN_ERROR '\a'
+
+// Longest received frame line: t iii l 16 data digits, timestamp, CR
+#define SLCAN_FRAME_MAX (1 + 3 + 1 + 16 + 4 + 1)
+
+// CAN rate in kbit/s for S0..S8, 0 where the driver has no timing for it
+static const int PROGMEM slcan_rates_PGM[] = {
+  10, 20, 50, 0, 125, 250, 500, 0, 1000
+};
+
+static const char PROGMEM hex_digits_PGM[] = "0123456789ABCDEF";
+
+SlcanGateway::SlcanGateway(HardwareSerial &serial) {
+  _serial = &serial;
+  _line_len = 0;
+  _out_len = 0;
+  _rate = 0;
+  _open = false;
+  _silent = false;
+  _timestamps = false;
+  _code = 0;
+  _mask = 0xFFFFFFFF;
+  _queue_overruns = 0;
+  _overruns = 0;
+  _reported_overruns = 0;
+}
+
+void SlcanGateway::begin(long baud) {
+  _serial->begin(baud);
+  // Frames come through the queue, not a callback
+  Can.detach();
+  CanBufferInit();
+}
+
+void SlcanGateway::poll() {
+  while (_serial->available()) {
+    char c = _serial->read();
+    if (c == '\r') {
+      command();
+      _line_len = 0;
+    } else if (c != '\n' && _line_len < SLCAN_LINE_SIZE) {
+      // A line that runs past the buffer is left at full length so that
+      // command() rejects it
+      _line[_line_len++] = c;
+    }
+  }
+  if (_open)
+    forward();
+  flush();
+}
+
+unsigned int SlcanGateway::overruns() {
+  countOverruns(Can.errorFlags());
+  return _overruns;
+}
+
+// Adds queue overruns since last time and any MCP2515 overflow in eflg
+void SlcanGateway::countOverruns(unsigned char eflg) {
+  unsigned int queued = CanBufferOverruns();
+  _overruns += queued - _queue_overruns;
+  _queue_overruns = queued;
+  if (eflg & 0xC0)
+    _overruns++;
+}
+
+/* Moves everything waiting in the receive queue into the output buffer,
+   flushing to the UART only when the buffer fills. */
+void SlcanGateway::forward() {
+  for (uint8_t n = 0; n < CAN_BUFFER_SIZE; n++) {
+    // Formatted straight from the pool block
+    CanMessage *msg = CanBufferTake();
+    if (!msg)
+      return;
+
+    if (_out_len + SLCAN_FRAME_MAX > SLCAN_OUT_SIZE)
+      flush();
+    put('t');
+    putHex(msg->id, 3);
+    put('0' + msg->len);
+    for (uint8_t i = 0; i < msg->len; i++)
+      putHex((uint8_t) msg->data[i], 2);
+    if (_timestamps)
+      putHex(CanBufferTime(msg) % 60000, 4);
+    put('\r');
+    CanBufferRelease(msg);
+  }
+}
+
+void SlcanGateway::command() {
+  const char *arg = _line + 1;
+  unsigned long value;
+
+  if (_line_len == SLCAN_LINE_SIZE) {
+    reply(SLCAN_ERROR);
+    return;
+  }
+  if (_line_len == 0) {
+    // slcand sends bare CRs to clear out anything half typed
+    reply(SLCAN_OK);
+    return;
+  }
+
+  switch (_line[0]) {
+    case 'S':
+      if (_open || _line_len != 2 || *arg < '0' || *arg > '8')
+        break;
+      _rate = pgm_read_word(slcan_rates_PGM + (*arg - '0'));
+      if (!_rate)
+        break;
+      reply(SLCAN_OK);
+      return;
+    case 'O':
+    case 'L':
+      if (_open || !_rate || _line_len != 1)
+        break;
+      open(_line[0] == 'L');
+      reply(SLCAN_OK);
+      return;
+    case 'C':
+      if (_open) {
+        Can.config(true);
+        _open = false;
+      }
+      reply(SLCAN_OK);
+      return;
+    case 't':
+      if (!transmit())
+        break;
+      put('z');
+      reply(SLCAN_OK);
+      return;
+    case 'M':
+    case 'm':
+      if (_open || _line_len != 9 || !parseHex(arg, 8, &value))
+        break;
+      if (_line[0] == 'M')
+        _code = value;
+      else
+        _mask = value;
+      reply(SLCAN_OK);
+      return;
+    case 'Z':
+      if (_open || _line_len != 2 || (*arg != '0' && *arg != '1'))
+        break;
+      _timestamps = *arg == '1';
+      reply(SLCAN_OK);
+      return;
+    case 'F': {
+      if (!_open)
+        break;
+      unsigned char eflg = Can.errorFlags();
+      unsigned char status = 0;
+      countOverruns(eflg);
+      if (_overruns != _reported_overruns)
+        status |= 0x08;   // data overrun
+      if (eflg & 0x01)
+        status |= 0x04;   // error warning
+      if (eflg & 0x18)
+        status |= 0x20;   // error passive
+      if (eflg & 0x20)
+        status |= 0x80;   // bus error (off)
+      _reported_overruns = _overruns;
+      put('F');
+      putHex(status, 2);
+      reply(SLCAN_OK);
+      return;
+    }
+    case 'V':
+      put('V');
+      putHex(0x0101, 4);
+      reply(SLCAN_OK);
+      return;
+    case 'N':
+      put('N');
+      putHex(0, 4);
+      reply(SLCAN_OK);
+      return;
+  }
+  // T, r, R and anything malformed
+  reply(SLCAN_ERROR);
+}
+
+/* Starts the controller at the chosen rate with the acceptance filter
+   applied.  Masks and filters can only be written in configuration mode,
+   so the channel is opened in config and switched over at the end. */
+void SlcanGateway::open(boolean silent) {
+  Can.begin(_rate);
+  Can.config(true);
+
+  // SJA1000 single filter layout: the standard ID is the top 11 bits of
+  // the code, and set bits in the mask are don't-care.  The MCP2515 mask
+  // is the other way round.
+  int id = (_code >> 21) & 0x7FF;
+  int mask = ~(_mask >> 21) & 0x7FF;
+  if (mask) {
+    Can.setMask(1, mask);
+    Can.setMask(2, mask);
+    Can.setFilter(1, 1, id);
+    Can.setFilter(1, 2, id);
+    for (int filter = 1; filter <= 4; filter++)
+      Can.setFilter(2, filter, id);
+    Can.filterOn();
+  } else {
+    Can.filterOff();
+  }
+
+  // Throw away anything queued while we were closed
+  CanBufferDrain(0);
+  _queue_overruns = CanBufferOverruns();
+
+  Can.monitor(silent);
+  _open = true;
+  _silent = silent;
+}
+
+boolean SlcanGateway::transmit() {
+  unsigned long id, len, byte;
+  char data[8];
+
+  if (!_open || _silent || _line_len < 5)
+    return false;
+  if (!parseHex(_line + 1, 3, &id) || id > 0x7FF)
+    return false;
+  len = _line[4] - '0';
+  if (len > 8 || _line_len != 5 + 2 * len)
+    return false;
+  for (uint8_t i = 0; i < len; i++) {
+    if (!parseHex(_line + 5 + 2 * i, 2, &byte))
+      return false;
+    data[i] = byte;
+  }
+  return Can.send(CanMessage(id, data, (char) len)) == 0;
+}
+
+void SlcanGateway::reply(char c) {
+  put(c);
+}
+
+void SlcanGateway::put(char c) {
+  if (_out_len == SLCAN_OUT_SIZE)
+    flush();
+  _out[_out_len++] = c;
+}
+
+void SlcanGateway::putHex(unsigned int value, uint8_t digits) {
+  while (digits--)
+    put(pgm_read_byte(hex_digits_PGM + ((value >> (4 * digits)) & 0x0F)));
+}
+
+void SlcanGateway::flush() {
+  if (_out_len) {
+    _serial->write(_out, _out_len);
+    _out_len = 0;
+  }
+}
+
+boolean SlcanGateway::parseHex(const char *p, uint8_t digits, unsigned long *value) {
+  unsigned long v = 0;
+  while (digits--) {
+    char c = *p++;
+    if (c >= '0' && c <= '9')
+      c -= '0';
+    else if (c >= 'A' && c <= 'F')
+      c -= 'A' - 10;
+    else if (c >= 'a' && c <= 'f')
+      c -= 'a' - 10;
+    else
+      return false;
+    v = (v << 4) | c;
+  }
+  *value = v;
+  return true;
+}
@@ -0,0 +1,71 @@
+/*
+  SlcanGateway.h - CAN to serial gateway speaking the SLCAN (Lawicel) ASCII
+  protocol, so slcand/SocketCAN on a PC can use the BRAIN as a CAN interface.
+
+  Supported commands (each ends in '\r'; replies are '\r' for OK or '\a'
+  for an error):
+    Sn      bit rate, n = 0..8 for 10k 20k 50k 100k 125k 250k 500k 800k 1M
+            (100k and 800k are not available with the 20 MHz MCP2515 setup)
+    O / L   open the channel normally / listen only
+    C       close the channel
+    tiiildd transmit a standard frame, replies 'z\r'
+    Mxxxxxxxx / mxxxxxxxx  acceptance code / mask, SJA1000 single filter
+            layout (the ID is the top 11 bits, mask bits set = don't care)
+    Zn      timestamps off (0) or on (1)
+    F       status flags, bit 3 = frames lost since the last F
+    V / N   version / serial number
+  Extended (T) and remote (r, R) frames are not supported by the driver and
+  are answered with '\a'.
+
+  Received frames are formatted straight out of the CAN frame pool, several
+  at a time into one buffer, so each UART burst carries as many frames as
+  are waiting.  The timestamp is the millis() at which the frame was
+  received, modulo 60000.
+*/
+#ifndef SlcanGateway_h
+#define SlcanGateway_h
+
+#include "WProgram.h"
+
+#define SLCAN_LINE_SIZE 32
+#define SLCAN_OUT_SIZE 104
+
+class SlcanGateway
+{
+  public:
+    SlcanGateway(HardwareSerial &serial);
+    // Starts the serial port; the CAN channel stays closed until 'O'
+    void begin(long baud);
+    // Handles pending commands and forwards received frames.  Call this
+    // from loop() as often as possible.
+    void poll();
+    // Frames lost: CAN receive queue overruns plus MCP2515 buffer overflows
+    unsigned int overruns();
+  private:
+    void command();
+    void forward();
+    boolean transmit();
+    void open(boolean silent);
+    void countOverruns(unsigned char eflg);
+    void reply(char c);
+    void put(char c);
+    void putHex(unsigned int value, uint8_t digits);
+    void flush();
+    boolean parseHex(const char *p, uint8_t digits, unsigned long *value);
+    HardwareSerial *_serial;
+    char _line[SLCAN_LINE_SIZE];
+    uint8_t _line_len;
+    uint8_t _out[SLCAN_OUT_SIZE];
+    uint8_t _out_len;
+    int _rate;
+    boolean _open;
+    boolean _silent;
+    boolean _timestamps;
+    unsigned long _code;
+    unsigned long _mask;
+    unsigned int _queue_overruns;
+    unsigned int _overruns;
+    unsigned int _reported_overruns;
+};
+
+#endif
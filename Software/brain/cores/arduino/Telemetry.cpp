@@ -0,0 +1,124 @@
+/*
+  Telemetry.cpp - Binary framed telemetry on top of any Print.
+  See Telemetry.h for the frame format.
+*/
+#include "WProgram.h"
+#include "Telemetry.h"
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+
+// Offsets into _buf.  _buf[0] is kept free for the first COBS code byte.
+#define FRAME_START 1
+#define HEADER_LEN 6
+
+Telemetry::Telemetry(Print &out) {
+  _out = &out;
+  _seq = 0;
+  _len = 0;
+  _overflow = false;
+  _overflows = 0;
+  _schema_count = 0;
+  _started = false;
+}
+
+int Telemetry::describe(uint8_t id, const char *descriptor) {
+  uint8_t slot;
+  for (slot = 0; slot < _schema_count; slot++)
+    if (_schema_ids[slot] == id)
+      break;
+  if (slot == _schema_count) {
+    if (_schema_count == TELEMETRY_MAX_RECORDS)
+      return 1;
+    _schema_count++;
+  }
+  _schema_ids[slot] = id;
+  _schemas[slot] = descriptor;
+  return sendSchema(slot);
+}
+
+void Telemetry::describeAll() {
+  for (uint8_t slot = 0; slot < _schema_count; slot++)
+    sendSchema(slot);
+}
+
+int Telemetry::sendSchema(uint8_t slot) {
+  const char *p = _schemas[slot];
+  uint8_t c;
+  begin(TELEMETRY_SCHEMA_ID);
+  add(_schema_ids[slot]);
+  while ((c = pgm_read_byte(p++)) != 0)
+    add(c);
+  return send();
+}
+
+void Telemetry::begin(uint8_t id) {
+  uint32_t now = millis();
+  _overflow = false;
+  _len = 0;
+  add(id);
+  add(_seq);
+  add(&now, sizeof(now));
+}
+
+void Telemetry::add(const void *data, uint8_t len) {
+  if (_len + len > TELEMETRY_MAX_FRAME) {
+    _overflow = true;
+    return;
+  }
+  memcpy(_buf + FRAME_START + _len, data, len);
+  _len += len;
+}
+
+void Telemetry::add(int8_t v) { add(&v, sizeof(v)); }
+void Telemetry::add(uint8_t v) { add(&v, sizeof(v)); }
+void Telemetry::add(int16_t v) { add(&v, sizeof(v)); }
+void Telemetry::add(uint16_t v) { add(&v, sizeof(v)); }
+void Telemetry::add(int32_t v) { add(&v, sizeof(v)); }
+void Telemetry::add(uint32_t v) { add(&v, sizeof(v)); }
+void Telemetry::add(float v) { add(&v, sizeof(v)); }
+void Telemetry::add(double v) { add((float) v); }
+
+int Telemetry::send() {
+  if (_overflow) {
+    _overflows++;
+    return 1;
+  }
+
+  uint8_t *frame = _buf + FRAME_START;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < _len; i++)
+    crc = _crc_ccitt_update(crc, frame[i]);
+  frame[_len++] = crc & 0xFF;
+  frame[_len++] = crc >> 8;
+
+  /* COBS encode in place.  Frames are shorter than 254 bytes, so there
+     is never a full block to split and encoding is just replacing each
+     zero (and the spare byte in front) with the distance to the next zero
+     or the end of the frame. */
+  uint8_t end = FRAME_START + _len;
+  uint8_t next = end;
+  for (uint8_t i = end; i-- > 0; ) {
+    if (_buf[i] == 0 || i == 0) {
+      _buf[i] = next - i;
+      next = i;
+    }
+  }
+  _buf[end] = 0;
+
+  // A zero ahead of the very first frame ends whatever the reader had
+  // buffered before we started talking
+  if (!_started) {
+    _out->write((uint8_t) 0);
+    _started = true;
+  }
+  _out->write(_buf, end + 1);
+
+  // Resend the schemas each time around so late joiners can decode
+  if (++_seq == 0)
+    describeAll();
+  return 0;
+}
+
+unsigned int Telemetry::overflows() {
+  return _overflows;
+}
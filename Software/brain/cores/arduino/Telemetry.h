@@ -0,0 +1,75 @@
+/*
+  Telemetry.h - Binary framed telemetry on top of any Print (usually Serial).
+
+  Each frame is COBS encoded and ends in a 0x00 byte, so a reader can always
+  resynchronise on the next zero.  Before encoding a frame is:
+
+    [record id:1][sequence:1][millis:4][fields...][crc16:2]
+
+  Multi-byte values are little endian.  The CRC is CRC-16/CCITT as computed
+  by avr-libc's _crc_ccitt_update (reflected 0x8408, initial 0xFFFF) over
+  everything before it.  The sequence number counts every frame sent, so a
+  gap means frames were lost.
+
+  Record id 0 is a schema frame.  Its fields are the id being described
+  followed by the descriptor text, e.g. "velocity:f32,power:f32,seen:u32".
+  Field types are i8 u8 i16 u16 i32 u32 f32.  Schemas are sent by describe()
+  and again every time the sequence number wraps, so a decoder that joins a
+  stream part way through learns them within 256 frames.
+
+  The host side decoder lives in Software/host/telemetry.
+*/
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include <inttypes.h>
+#include "Print.h"
+
+#define TELEMETRY_SCHEMA_ID 0
+#define TELEMETRY_MAX_RECORDS 8
+// Largest header plus fields, not counting the CRC
+#define TELEMETRY_MAX_FRAME 64
+
+class Telemetry
+{
+  public:
+    Telemetry(Print &out);
+    // Registers a record layout (descriptor in flash, from PSTR()) and
+    // sends its schema frame.  Returns 1 if the table is full or the
+    // schema frame is too long to send.
+    int describe(uint8_t id, const char *descriptor);
+    // Resends every registered schema
+    void describeAll();
+    // Starts a data frame for record id, stamped with millis()
+    void begin(uint8_t id);
+    void add(int8_t);
+    void add(uint8_t);
+    void add(int16_t);
+    void add(uint16_t);
+    void add(int32_t);
+    void add(uint32_t);
+    void add(float);
+    void add(double);
+    void add(const void *data, uint8_t len);
+    // Finishes and writes the frame.  0 on success, 1 if the fields did not
+    // fit in TELEMETRY_MAX_FRAME (the frame is dropped).
+    int send();
+    // Number of frames dropped for being too long
+    unsigned int overflows();
+  private:
+    int sendSchema(uint8_t slot);
+    Print *_out;
+    uint8_t _seq;
+    uint8_t _len;
+    bool _overflow;
+    bool _started;
+    unsigned int _overflows;
+    uint8_t _schema_ids[TELEMETRY_MAX_RECORDS];
+    const char *_schemas[TELEMETRY_MAX_RECORDS];
+    uint8_t _schema_count;
+    // One byte for the leading COBS code, the frame, the CRC and the
+    // trailing zero.  The frame is encoded in place.
+    uint8_t _buf[1 + TELEMETRY_MAX_FRAME + 2 + 1];
+};
+
+#endif
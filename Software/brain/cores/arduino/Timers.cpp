@@ -0,0 +1,229 @@
+/*
+  Timers.cpp - Software timers on a hierarchical timer wheel.
+  See Timers.h for how the wheel is laid out.
+*/
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "Timers.h"
+
+#define TIMER_USER_FLAGS (TIMER_PERIODIC | TIMER_DEFERRED)
+#define TIMER_ACTIVE 0x10   // in the wheel
+#define TIMER_QUEUED 0x20   // on the pending list
+#define TIMER_DUE 0x40      // to be run by the next poll()
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+TimerWheel Timers;
+
+static void timersTick() {
+  Timers.tick();
+}
+
+Timer::Timer() {
+  _next = 0;
+  _pprev = 0;
+  _next_pending = 0;
+  _expires = 0;
+  _period = 0;
+  _callback = 0;
+  _arg = 0;
+  _flags = 0;
+}
+
+bool Timer::active() {
+  return _flags & TIMER_ACTIVE;
+}
+
+TimerWheel::TimerWheel() {
+  memset(_slots, 0, sizeof(_slots));
+  _now = 0;
+  _pending_head = 0;
+  _pending_tail = 0;
+  _missed = 0;
+  _running = false;
+}
+
+void TimerWheel::start(Timer &timer, unsigned long ms, TimerCallback callback,
+                       void *arg, uint8_t flags) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!_running) {
+    // Everything up to the current millisecond counts as processed
+    _now = timer0_millis;
+    _running = true;
+    timer0_hook = timersTick;
+  }
+
+  if (timer._pprev) {
+    *timer._pprev = timer._next;
+    if (timer._next)
+      timer._next->_pprev = timer._pprev;
+  }
+  if (!ms)
+    ms = 1;
+  timer._callback = callback;
+  timer._arg = arg;
+  timer._period = ms;
+  timer._expires = _now + ms;
+  timer._flags = (timer._flags & TIMER_QUEUED) | (flags & TIMER_USER_FLAGS) |
+                 TIMER_ACTIVE;
+  add(&timer);
+  SREG = oldSREG;
+}
+
+void TimerWheel::cancel(Timer &timer) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (timer._pprev) {
+    *timer._pprev = timer._next;
+    if (timer._next)
+      timer._next->_pprev = timer._pprev;
+    timer._next = 0;
+    timer._pprev = 0;
+  }
+  // A queued timer stays on the pending list; poll() skips it
+  timer._flags &= ~(TIMER_ACTIVE | TIMER_DUE);
+  SREG = oldSREG;
+}
+
+void TimerWheel::poll() {
+  for (;;) {
+    uint8_t oldSREG = SREG;
+    cli();
+    Timer *timer = _pending_head;
+    if (!timer) {
+      SREG = oldSREG;
+      return;
+    }
+    _pending_head = timer->_next_pending;
+    if (!_pending_head)
+      _pending_tail = 0;
+    uint8_t due = timer->_flags & TIMER_DUE;
+    timer->_flags &= ~(TIMER_QUEUED | TIMER_DUE);
+    TimerCallback callback = timer->_callback;
+    void *arg = timer->_arg;
+    SREG = oldSREG;
+
+    if (due)
+      callback(arg);
+  }
+}
+
+unsigned int TimerWheel::missed() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int missed = _missed;
+  SREG = oldSREG;
+  return missed;
+}
+
+/* Files a timer in the coarsest level whose slots still separate it from
+   now.  Interrupts must be off. */
+void TimerWheel::add(Timer *timer) {
+  unsigned long expires = timer->_expires;
+  unsigned long delta = expires - _now;
+  Timer **slot;
+
+  if ((long) delta < 0) {
+    // Only possible if a timer was filed late; run it this tick
+    expires = _now;
+    delta = 0;
+  }
+  if (delta < 1UL << TIMER_WHEEL_BITS)
+    slot = &_slots[0][expires & SLOT_MASK];
+  else if (delta < 1UL << (2 * TIMER_WHEEL_BITS))
+    slot = &_slots[1][(expires >> TIMER_WHEEL_BITS) & SLOT_MASK];
+  else if (delta < 1UL << (3 * TIMER_WHEEL_BITS))
+    slot = &_slots[2][(expires >> (2 * TIMER_WHEEL_BITS)) & SLOT_MASK];
+  else if (delta < 1UL << (4 * TIMER_WHEEL_BITS))
+    slot = &_slots[3][(expires >> (3 * TIMER_WHEEL_BITS)) & SLOT_MASK];
+  else
+    // Out of range: park it in the last top level slot to come round, and
+    // file it again from there
+    slot = &_slots[3][((_now >> (3 * TIMER_WHEEL_BITS)) - 1) & SLOT_MASK];
+
+  timer->_next = *slot;
+  if (*slot)
+    (*slot)->_pprev = &timer->_next;
+  *slot = timer;
+  timer->_pprev = slot;
+}
+
+// Moves every timer in a slot down to the level below
+void TimerWheel::cascade(uint8_t level, uint8_t slot) {
+  Timer *list = _slots[level][slot];
+  _slots[level][slot] = 0;
+  while (list) {
+    Timer *timer = list;
+    list = timer->_next;
+    add(timer);
+  }
+}
+
+void TimerWheel::expire(Timer *timer) {
+  uint8_t flags = timer->_flags;
+
+  if (flags & TIMER_PERIODIC) {
+    // From the previous expiry time, so a late tick doesn't add drift
+    timer->_expires += timer->_period;
+    add(timer);
+  } else {
+    flags &= ~TIMER_ACTIVE;
+  }
+
+  if (flags & TIMER_DEFERRED) {
+    if (!(flags & TIMER_QUEUED)) {
+      timer->_next_pending = 0;
+      if (_pending_tail)
+        _pending_tail->_next_pending = timer;
+      else
+        _pending_head = timer;
+      _pending_tail = timer;
+      flags |= TIMER_QUEUED;
+    } else if (flags & TIMER_DUE) {
+      _missed++;
+    }
+    timer->_flags = flags | TIMER_DUE;
+  } else {
+    timer->_flags = flags;
+    timer->_callback(timer->_arg);
+  }
+}
+
+/* Processes every millisecond that millis() has moved on since the last
+   call: at each one, refill the lower levels from any slot that has come
+   round, then expire the 1 ms slot for that millisecond.  Runs from the
+   timer 0 interrupt, so interrupts are already off. */
+void TimerWheel::tick() {
+  while (_now != timer0_millis) {
+    _now++;
+    uint8_t index = _now & SLOT_MASK;
+    if (!index) {
+      uint8_t index1 = (_now >> TIMER_WHEEL_BITS) & SLOT_MASK;
+      cascade(1, index1);
+      if (!index1) {
+        uint8_t index2 = (_now >> (2 * TIMER_WHEEL_BITS)) & SLOT_MASK;
+        cascade(2, index2);
+        if (!index2)
+          cascade(3, (_now >> (3 * TIMER_WHEEL_BITS)) & SLOT_MASK);
+      }
+    }
+
+    // Detach the slot before running anything, so a periodic timer that
+    // lands back in the same slot waits for the next lap.  Callbacks can
+    // still cancel timers on the detached list through their _pprev.
+    Timer *list = _slots[0][index];
+    _slots[0][index] = 0;
+    if (list)
+      list->_pprev = &list;
+    while (list) {
+      Timer *timer = list;
+      list = timer->_next;
+      if (list)
+        list->_pprev = &list;
+      timer->_next = 0;
+      timer->_pprev = 0;
+      expire(timer);
+    }
+  }
+}
@@ -0,0 +1,101 @@
+/*
+  Timers.h - Software timers on a hierarchical timer wheel, driven by the
+  timer 0 interrupt that keeps millis().
+
+  Each Timer is a node owned by the caller, so there is no allocation and
+  no limit on how many can run.  Starting and cancelling a timer are O(1),
+  and the interrupt only looks at the timers due in the current
+  millisecond, so expiry costs the same however many are registered.
+
+  The wheel has four levels of 16 slots, 1 ms, 16 ms, 256 ms and 4096 ms
+  wide.  A timer sits in the coarsest level that can hold it and moves
+  down a level each time that level's slot comes round; timers further
+  out than 65 s wait in the top level and are re-filed until they are in
+  range.  Timers fire on the millisecond tick at which millis() reaches
+  their expiry time, so a delay of N ms is between N-1 and N ms long.
+
+  Callbacks run in one of two places:
+    - by default, from the timer 0 interrupt.  Interrupts are off and
+      millis() does not advance until the callback returns, so keep it
+      short: set a flag, toggle a pin, queue a message.
+    - with TIMER_DEFERRED, from Timers.poll(), which the sketch calls from
+      loop().  The callback can take as long as it likes.  If a periodic
+      deferred timer expires again before poll() has run it, the runs are
+      merged and counted in missed().
+
+  A callback may start or cancel any timer, including its own.
+
+    Timer blink;
+    void toggle(void *) { digitalWrite(13, !digitalRead(13)); }
+    void setup() { Timers.start(blink, 500, toggle, 0, TIMER_PERIODIC); }
+    void loop() { Timers.poll(); }
+*/
+#ifndef Timers_h
+#define Timers_h
+
+#include <inttypes.h>
+
+#define TIMER_PERIODIC 0x01
+#define TIMER_DEFERRED 0x02
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 4
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef void (*TimerCallback)(void *arg);
+
+class Timer
+{
+  public:
+    Timer();
+    // True while the timer is waiting to expire (or, for a periodic timer,
+    // until it is cancelled)
+    bool active();
+  private:
+    friend class TimerWheel;
+    // wheel slot list; _pprev points at whatever points at us
+    Timer *_next;
+    Timer **_pprev;
+    // deferred run queue
+    Timer *_next_pending;
+    unsigned long _expires;
+    unsigned long _period;
+    TimerCallback _callback;
+    void *_arg;
+    volatile uint8_t _flags;
+};
+
+class TimerWheel
+{
+  public:
+    TimerWheel();
+    // Runs callback(arg) in ms milliseconds, and every ms milliseconds after
+    // that if flags includes TIMER_PERIODIC.  A timer that is already
+    // running is restarted.  ms of 0 is treated as 1.
+    void start(Timer &timer, unsigned long ms, TimerCallback callback,
+               void *arg = 0, uint8_t flags = 0);
+    // Stops the timer.  A deferred callback that is due but has not been run
+    // by poll() yet is dropped.
+    void cancel(Timer &timer);
+    // Runs the callbacks of expired TIMER_DEFERRED timers
+    void poll();
+    // Deferred expiries merged because poll() was not called in time
+    unsigned int missed();
+    // Called from the timer 0 interrupt
+    void tick();
+  private:
+    void add(Timer *timer);
+    void cascade(uint8_t level, uint8_t slot);
+    void expire(Timer *timer);
+    Timer *_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    // next millisecond to process
+    unsigned long _now;
+    Timer *_pending_head;
+    Timer *_pending_tail;
+    unsigned int _missed;
+    bool _running;
+};
+
+extern TimerWheel Timers;
+
+#endif
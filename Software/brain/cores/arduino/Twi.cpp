@@ -0,0 +1,321 @@
+/*
+  Twi.cpp - Interrupt driven I2C (TWI) master with a transaction queue.
+  See Twi.h for how to use it.
+*/
+#include <util/twi.h>
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "Twi.h"
+
+// TWCR to carry on: clear the flag, keep the TWI and its interrupt on
+#define TWCR_GO (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+// Longest wait for a STOP with interrupts off, in passes of a 6 cycle loop
+#define TWI_STOP_SPINS_MAX 300
+
+TwiMaster Twi;
+
+ISR(TWI_vect) {
+  Twi.step();
+}
+
+TwiTransaction::TwiTransaction() {
+  _next = 0;
+  _status = TWI_OK;
+}
+
+uint8_t TwiTransaction::status() {
+  return _status;
+}
+
+boolean TwiTransaction::done() {
+  return _status != TWI_PENDING;
+}
+
+TwiMaster::TwiMaster() {
+  _head = 0;
+  _tail = 0;
+  _index = 0;
+  _reading = false;
+  _stop_spins = 0;
+  _stop_waited = 0;
+  _timeout_ms = TWI_TIMEOUT_MS;
+  _completed = 0;
+  _errors = 0;
+  _timeouts = 0;
+}
+
+unsigned long TwiMaster::begin(unsigned long hz) {
+  // Internal pull-ups on SCL and SDA
+  pinMode(16, INPUT);
+  pinMode(17, INPUT);
+  digitalWrite(16, HIGH);
+  digitalWrite(17, HIGH);
+  unsigned long actual = setClock(hz);
+  TWCR = _BV(TWEN) | _BV(TWIE);
+  return actual;
+}
+
+/* Turns the TWI off.  Anything still queued is left pending for ever, so
+   only call this when busy() is false. */
+void TwiMaster::end() {
+  Timers.cancel(_watchdog);
+  TWCR = 0;
+  digitalWrite(16, LOW);
+  digitalWrite(17, LOW);
+}
+
+/* SCL is F_CPU / (16 + 2 * TWBR * 4^TWPS).  TWBR is rounded up, so the
+   clock is never faster than asked, and the smallest prescaler that fits
+   is used for the finest steps. */
+unsigned long TwiMaster::setClock(unsigned long hz) {
+  if (hz > 400000)
+    hz = 400000;
+  if (hz == 0)
+    hz = 1;
+  unsigned long cycles = (F_CPU + hz - 1) / hz;
+  if (cycles < 16)
+    cycles = 16;
+  uint8_t ps = 0;
+  unsigned long twbr;
+  for (;;) {
+    unsigned long step = 2UL << (2 * ps);
+    twbr = (cycles - 16 + step - 1) / step;
+    if (twbr <= 255)
+      break;
+    if (++ps == 4) {
+      // As slow as it goes
+      ps = 3;
+      twbr = 255;
+      break;
+    }
+  }
+  TWSR = ps;
+  TWBR = twbr;
+  unsigned long period = 16 + (2UL << (2 * ps)) * twbr;
+  // A STOP goes out within about two SCL periods unless a slave holds SCL
+  _stop_spins = period / 3 > TWI_STOP_SPINS_MAX ? TWI_STOP_SPINS_MAX : period / 3;
+  return F_CPU / period;
+}
+
+void TwiMaster::timeout(unsigned int ms) {
+  _timeout_ms = ms ? ms : 1;
+}
+
+int TwiMaster::write(TwiTransaction &t, uint8_t address, const uint8_t *data,
+                     uint8_t length, TwiCallback callback, void *arg) {
+  return writeRead(t, address, data, length, 0, 0, callback, arg);
+}
+
+int TwiMaster::read(TwiTransaction &t, uint8_t address, uint8_t *data,
+                    uint8_t length, TwiCallback callback, void *arg) {
+  return writeRead(t, address, 0, 0, data, length, callback, arg);
+}
+
+int TwiMaster::writeRead(TwiTransaction &t, uint8_t address, const uint8_t *out,
+                         uint8_t out_length, uint8_t *in, uint8_t in_length,
+                         TwiCallback callback, void *arg) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (t._status == TWI_PENDING) {
+    SREG = oldSREG;
+    return 1;
+  }
+  t._next = 0;
+  t._address = address;
+  t._out = out;
+  t._out_length = out_length;
+  t._in = in;
+  t._in_length = in_length;
+  t._callback = callback;
+  t._arg = arg;
+  t._status = TWI_PENDING;
+  if (_tail) {
+    _tail->_next = &t;
+    _tail = &t;
+  } else {
+    _head = _tail = &t;
+    // A STOP from the last transaction may still be going out.  It takes
+    // a couple of SCL periods, but a slave holding SCL can keep it going
+    // indefinitely, so only wait that long with interrupts off and then
+    // look again every millisecond from the timer wheel.
+    uint16_t spins = _stop_spins;
+    while ((TWCR & _BV(TWSTO)) && spins)
+      spins--;
+    if (TWCR & _BV(TWSTO)) {
+      _stop_waited = 0;
+      Timers.start(_watchdog, 1, waitStop, this);
+    } else {
+      prepare();
+      TWCR = TWCR_GO | _BV(TWSTA);
+    }
+  }
+  SREG = oldSREG;
+  return 0;
+}
+
+/* Sets up to run the transaction at the head of the queue, which the
+   caller then STARTs.  With nothing to write or read it is an address
+   probe: SLA+W, and done on the ACK. */
+void TwiMaster::prepare() {
+  _index = 0;
+  _reading = !_head->_out_length && _head->_in_length;
+  Timers.start(_watchdog, _timeout_ms, expire, this);
+}
+
+/* Ends the transaction at the head of the queue, and starts the next one
+   if there is one, with a STOP first if stop is set.  With interrupts
+   off, from one of the interrupts. */
+void TwiMaster::finish(uint8_t status, uint8_t stop) {
+  TwiTransaction *t = _head;
+  Timers.cancel(_watchdog);
+  _head = t->_next;
+  if (!_head)
+    _tail = 0;
+  t->_next = 0;
+
+  if (status == TWI_OK)
+    _completed++;
+  else if (status == TWI_TIMEOUT)
+    _timeouts++;
+  else
+    _errors++;
+
+  uint8_t control = TWCR_GO | (stop ? _BV(TWSTO) : 0);
+  if (_head) {
+    // STOP and START together send one then the other
+    prepare();
+    control |= _BV(TWSTA);
+  }
+  TWCR = control;
+
+  t->_status = status;
+  if (t->_callback)
+    t->_callback(status, t->_arg);
+}
+
+void TwiMaster::step() {
+  TwiTransaction *t = _head;
+  if (!t) {
+    // Nothing of ours; let go of the bus
+    TWCR = TWCR_GO | _BV(TWSTO);
+    return;
+  }
+
+  switch (TW_STATUS) {
+    case TW_START:
+    case TW_REP_START:
+      TWDR = (t->_address << 1) | (_reading ? TW_READ : TW_WRITE);
+      TWCR = TWCR_GO;
+      break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (_index < t->_out_length) {
+        TWDR = t->_out[_index++];
+        TWCR = TWCR_GO;
+      } else if (t->_in_length) {
+        // Repeated start for the read half
+        _reading = true;
+        _index = 0;
+        TWCR = TWCR_GO | _BV(TWSTA);
+      } else {
+        finish(TWI_OK, true);
+      }
+      break;
+
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+      finish(TWI_NACK_ADDRESS, true);
+      break;
+
+    case TW_MT_DATA_NACK:
+      finish(TWI_NACK_DATA, true);
+      break;
+
+    case TW_MT_ARB_LOST:
+      // The bus is someone else's; no STOP, and a START waits for it
+      finish(TWI_ARBITRATION, false);
+      break;
+
+    case TW_MR_SLA_ACK:
+      // ACK every byte but the last
+      TWCR = TWCR_GO | (t->_in_length > 1 ? _BV(TWEA) : 0);
+      break;
+
+    case TW_MR_DATA_ACK:
+      t->_in[_index++] = TWDR;
+      TWCR = TWCR_GO | (_index + 1 < t->_in_length ? _BV(TWEA) : 0);
+      break;
+
+    case TW_MR_DATA_NACK:
+      t->_in[_index++] = TWDR;
+      finish(TWI_OK, true);
+      break;
+
+    case TW_BUS_ERROR:
+      // TWSTO here just resets the TWI, no STOP goes out
+      finish(TWI_BUS_ERROR, true);
+      break;
+  }
+}
+
+// Timer callback, in the timer 0 interrupt, when a transaction has taken
+// too long
+void TwiMaster::expire(void *arg) {
+  TwiMaster *twi = (TwiMaster *) arg;
+  if (!twi->_head)
+    return;
+  // Reset the TWI, dropping a pending interrupt, and start again
+  TWCR = _BV(TWINT);
+  TWCR = _BV(TWEN) | _BV(TWIE);
+  twi->finish(TWI_TIMEOUT, false);
+}
+
+// Timer callback, in the timer 0 interrupt, once a millisecond while a
+// STOP holds up the first transaction of a queue.  Gives up, resetting the
+// TWI, after the timeout.
+void TwiMaster::waitStop(void *arg) {
+  TwiMaster *twi = (TwiMaster *) arg;
+  if (!twi->_head)
+    return;
+  if (!(TWCR & _BV(TWSTO))) {
+    twi->prepare();
+    TWCR = TWCR_GO | _BV(TWSTA);
+  } else if (++twi->_stop_waited < twi->_timeout_ms) {
+    Timers.start(twi->_watchdog, 1, waitStop, twi);
+  } else {
+    expire(arg);
+  }
+}
+
+boolean TwiMaster::busy() {
+  uint8_t oldSREG = SREG;
+  cli();
+  boolean busy = _head != 0;
+  SREG = oldSREG;
+  return busy;
+}
+
+unsigned long TwiMaster::completed() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long completed = _completed;
+  SREG = oldSREG;
+  return completed;
+}
+
+unsigned int TwiMaster::errors() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int errors = _errors;
+  SREG = oldSREG;
+  return errors;
+}
+
+unsigned int TwiMaster::timeouts() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int timeouts = _timeouts;
+  SREG = oldSREG;
+  return timeouts;
+}
@@ -0,0 +1,122 @@
+/*
+  Twi.h - Interrupt driven I2C (TWI) master with a transaction queue.
+
+  A polled I2C read stalls the loop for the whole transfer, a few hundred
+  microseconds even at 400 kHz.  Here each transfer is a TwiTransaction,
+  owned by the caller like a Timer, that is queued and then run byte by
+  byte from the TWI interrupt.  The sketch carries on and is told when it
+  is done, by a callback from the interrupt or by polling done():
+
+    uint8_t reg = 0x00, temp[2];
+    TwiTransaction readTemp;
+    void gotTemp(uint8_t status, void *) { if (status == TWI_OK) ... }
+
+    Twi.begin(400000);
+    Twi.writeRead(readTemp, 0x48, &reg, 1, temp, 2, gotTemp);
+
+  Transactions run in the order queued.  A write-then-read uses a repeated
+  start, so no other master can get in between; back to back transactions
+  share one STOP-START.  The buffers must stay put until the transaction
+  is done, and a transaction can't be queued again until then.  The
+  callback may queue more transactions.
+
+  Each transaction has a timeout, on the Timers wheel, in case a device
+  holds the bus: the TWI is reset, the transaction fails with TWI_TIMEOUT
+  and the queue moves on.  NACKs, lost arbitration and bus errors fail
+  the transaction with their own status, and all are counted.
+
+  SCL and SDA are pins 16 and 17 (PC0, PC1).  begin() turns the internal
+  pull-ups on, which are only good enough for short buses at 100 kHz;
+  use external ones for 400 kHz.
+*/
+#ifndef Twi_h
+#define Twi_h
+
+#include <inttypes.h>
+#include "Timers.h"
+
+// Transaction status
+#define TWI_OK 0
+#define TWI_PENDING 1
+#define TWI_NACK_ADDRESS 2
+#define TWI_NACK_DATA 3
+#define TWI_ARBITRATION 4
+#define TWI_BUS_ERROR 5
+#define TWI_TIMEOUT 6
+
+#define TWI_TIMEOUT_MS 10
+
+typedef void (*TwiCallback)(uint8_t status, void *arg);
+
+class TwiTransaction
+{
+  public:
+    TwiTransaction();
+    // TWI_PENDING while queued or running, then how it ended
+    uint8_t status();
+    boolean done();
+  private:
+    friend class TwiMaster;
+    TwiTransaction *_next;
+    uint8_t _address;
+    const uint8_t *_out;
+    uint8_t _out_length;
+    uint8_t *_in;
+    uint8_t _in_length;
+    TwiCallback _callback;
+    void *_arg;
+    volatile uint8_t _status;
+};
+
+class TwiMaster
+{
+  public:
+    TwiMaster();
+    // Enables the TWI at the fastest SCL no higher than hz (up to 400 kHz)
+    // and returns it
+    unsigned long begin(unsigned long hz = 100000);
+    void end();
+    unsigned long setClock(unsigned long hz);
+    // How long a transaction may take before it is abandoned
+    void timeout(unsigned int ms);
+    // Queue a transaction for the 7-bit address.  Returns 1 if the
+    // transaction is still pending from before.  With no data either way
+    // it just addresses the device for writing, to see if it ACKs.
+    int write(TwiTransaction &t, uint8_t address, const uint8_t *data,
+              uint8_t length, TwiCallback callback = 0, void *arg = 0);
+    int read(TwiTransaction &t, uint8_t address, uint8_t *data,
+             uint8_t length, TwiCallback callback = 0, void *arg = 0);
+    int writeRead(TwiTransaction &t, uint8_t address, const uint8_t *out,
+                  uint8_t out_length, uint8_t *in, uint8_t in_length,
+                  TwiCallback callback = 0, void *arg = 0);
+    // True while anything is queued or running
+    boolean busy();
+    // Transactions that ended with TWI_OK
+    unsigned long completed();
+    // Transactions failed by NACK, lost arbitration or bus error
+    unsigned int errors();
+    // Transactions abandoned after the timeout
+    unsigned int timeouts();
+    // Called from the TWI interrupt
+    void step();
+  private:
+    void prepare();
+    void finish(uint8_t status, uint8_t stop);
+    static void expire(void *arg);
+    static void waitStop(void *arg);
+    TwiTransaction *volatile _head;
+    TwiTransaction *_tail;
+    uint8_t _index;
+    boolean _reading;
+    uint16_t _stop_spins;
+    unsigned int _stop_waited;
+    unsigned int _timeout_ms;
+    unsigned long _completed;
+    unsigned int _errors;
+    unsigned int _timeouts;
+    Timer _watchdog;
+};
+
+extern TwiMaster Twi;
+
+#endif
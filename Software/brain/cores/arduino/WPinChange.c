@@ -0,0 +1,214 @@
+/*
+  WPinChange.c - pin change interrupts with per pin callbacks
+
+  The ATmega324P has one pin change interrupt per port (PCINT0 for port A
+  up to PCINT3 for port D), each firing when any enabled pin on that port
+  changes.  This file owns all four vectors and sorts out which pin moved
+  by comparing the port against the value it had at the last interrupt,
+  so edges are selected in software:
+
+    RISING   called when the pin goes high
+    FALLING  called when the pin goes low
+    CHANGE   called on either edge
+    LOW      called on every interrupt from that port while the pin is low,
+             as well as when it goes low.  For level outputs like the
+             MCP2515 INT, which can stay low across several changes.
+
+  A port with no callbacks has its interrupt switched off; within a port
+  only pins with a callback are enabled, so other pins cost nothing.  Two
+  changes closer together than the interrupt latency look like no change
+  at all, so very short pulses can be missed.
+
+  suspendPinChangeInterrupt() holds off one pin's callback, for example the
+  MCP2515 INT around an SPI transfer, while the rest of the port carries on.
+*/
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "WConstants.h"
+#include "wiring_private.h"
+#include "pins_arduino.h"
+
+#define PCINT_PORTS 4
+
+volatile static voidFuncPtr pcintFunc[PCINT_PORTS * 8];
+// port value at the last interrupt, and which bits want which edges
+static uint8_t pcintLast[PCINT_PORTS];
+static uint8_t pcintRising[PCINT_PORTS];
+static uint8_t pcintFalling[PCINT_PORTS];
+static uint8_t pcintLow[PCINT_PORTS];
+
+static volatile uint8_t *pcintMask(uint8_t port)
+{
+	switch (port) {
+	case 0: return &PCMSK0;
+	case 1: return &PCMSK1;
+	case 2: return &PCMSK2;
+	default: return &PCMSK3;
+	}
+}
+
+static uint8_t pcintRead(uint8_t port)
+{
+	switch (port) {
+	case 0: return PINA;
+	case 1: return PINB;
+	case 2: return PINC;
+	default: return PIND;
+	}
+}
+
+/* Calls userFunc on the given edge (RISING, FALLING, CHANGE) or level (LOW)
+ * of a digital pin, from the pin change interrupt.  Replaces any callback
+ * already on the pin. */
+void attachPinChangeInterrupt(uint8_t pin, void (*userFunc)(void), int mode)
+{
+	uint8_t port = digitalPinToPort(pin);
+	uint8_t mask = digitalPinToBitMask(pin);
+	uint8_t bit = 0;
+	uint8_t oldSREG;
+
+	if (port == NOT_A_PIN || !userFunc)
+		return;
+	// PCINT ports run A to D, which the pin tables number 1 to 4
+	port--;
+	while (!(mask & (1 << bit)))
+		bit++;
+
+	oldSREG = SREG;
+	cli();
+	pcintFunc[port * 8 + bit] = userFunc;
+	pcintRising[port] &= ~mask;
+	pcintFalling[port] &= ~mask;
+	pcintLow[port] &= ~mask;
+	if (mode == RISING || mode == CHANGE)
+		pcintRising[port] |= mask;
+	if (mode == FALLING || mode == CHANGE)
+		pcintFalling[port] |= mask;
+	if (mode == LOW)
+		pcintLow[port] |= mask;
+
+	// Start the comparison from the pin as it is now
+	pcintLast[port] = (pcintLast[port] & ~mask) | (pcintRead(port) & mask);
+	*pcintMask(port) |= mask;
+	PCICR |= _BV(port);
+	SREG = oldSREG;
+}
+
+void detachPinChangeInterrupt(uint8_t pin)
+{
+	uint8_t port = digitalPinToPort(pin);
+	uint8_t mask = digitalPinToBitMask(pin);
+	volatile uint8_t *pcmsk;
+	uint8_t oldSREG;
+
+	if (port == NOT_A_PIN)
+		return;
+	port--;
+
+	oldSREG = SREG;
+	cli();
+	pcmsk = pcintMask(port);
+	*pcmsk &= ~mask;
+	if (!*pcmsk)
+		PCICR &= ~_BV(port);
+	pcintRising[port] &= ~mask;
+	pcintFalling[port] &= ~mask;
+	pcintLow[port] &= ~mask;
+	SREG = oldSREG;
+}
+
+/* Keeps one pin's callback from running, without touching the rest of
+ * its port, until resumePinChangeInterrupt().  For guarding code that must
+ * not be interrupted by that callback, such as an SPI transfer to the
+ * device whose INT line it is. */
+void suspendPinChangeInterrupt(uint8_t pin)
+{
+	uint8_t port = digitalPinToPort(pin);
+	uint8_t oldSREG;
+
+	if (port == NOT_A_PIN)
+		return;
+	oldSREG = SREG;
+	cli();
+	*pcintMask(port - 1) &= ~digitalPinToBitMask(pin);
+	SREG = oldSREG;
+}
+
+/* Undoes suspendPinChangeInterrupt().  The pin's value while suspended is
+ * never taken as its last value, so an edge it made in the meantime is
+ * still seen, and a LOW callback still runs if the pin is low.  Called
+ * with interrupts on, anything due is handled here, with interrupts off as
+ * in the interrupt.  From an interrupt it is left to the next pin change,
+ * or to the caller, who knows whether it needs checking again. */
+void resumePinChangeInterrupt(uint8_t pin)
+{
+	uint8_t port = digitalPinToPort(pin);
+	uint8_t mask = digitalPinToBitMask(pin);
+	uint8_t bit = 0;
+	uint8_t oldSREG, now, fire;
+
+	if (port == NOT_A_PIN)
+		return;
+	port--;
+	while (!(mask & (1 << bit)))
+		bit++;
+
+	oldSREG = SREG;
+	cli();
+	if (!((pcintRising[port] | pcintFalling[port] | pcintLow[port]) & mask)) {
+		// not attached, or detached meanwhile
+		SREG = oldSREG;
+		return;
+	}
+	*pcintMask(port) |= mask;
+	now = pcintRead(port);
+	fire = (((now ^ pcintLast[port]) & ((now & pcintRising[port]) | (~now & pcintFalling[port]))) |
+	        (~now & pcintLow[port])) & mask;
+	if ((oldSREG & _BV(SREG_I)) && fire) {
+		pcintLast[port] = (pcintLast[port] & ~mask) | (now & mask);
+		pcintFunc[port * 8 + bit]();
+	}
+	SREG = oldSREG;
+}
+
+static inline void pcintDispatch(uint8_t port, uint8_t now) __attribute__ ((always_inline));
+static inline void pcintDispatch(uint8_t port, uint8_t now)
+{
+	// suspended pins are left out, and keep the value they had
+	uint8_t enabled = *pcintMask(port);
+	uint8_t changed = now ^ pcintLast[port];
+	uint8_t fire;
+	volatile voidFuncPtr *func;
+
+	pcintLast[port] = (now & enabled) | (pcintLast[port] & ~enabled);
+	fire = ((changed & ((now & pcintRising[port]) | (~now & pcintFalling[port]))) |
+	        (~now & pcintLow[port])) & enabled;
+
+	func = pcintFunc + port * 8;
+	while (fire) {
+		if (fire & 1)
+			(*func)();
+		fire >>= 1;
+		func++;
+	}
+}
+
+ISR(PCINT0_vect) {
+	pcintDispatch(0, PINA);
+}
+
+ISR(PCINT1_vect) {
+	pcintDispatch(1, PINB);
+}
+
+ISR(PCINT2_vect) {
+	pcintDispatch(2, PINC);
+}
+
+ISR(PCINT3_vect) {
+	pcintDispatch(3, PIND);
+}
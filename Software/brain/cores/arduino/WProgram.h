@@ -8,10 +8,23 @@
 #include <avr/interrupt.h>
 
 #include "wiring.h"
+#include "FastPin.h"
+#include "Pwm16.h"
 
 #ifdef __cplusplus
 #include "HardwareSerial.h"
 #include "HardwareCan.h"
+#include "Telemetry.h"
+#include "SlcanGateway.h"
+#include "Timers.h"
+#include "Scheduler.h"
+#include "AnalogScan.h"
+#include "Capture.h"
+#include "Quadrature.h"
+#include "Fault.h"
+#include "Waveform.h"
+#include "Twi.h"
+#include "OneWireBus.h"
 
 uint16_t makeWord(uint16_t w);
 uint16_t makeWord(byte h, byte l);
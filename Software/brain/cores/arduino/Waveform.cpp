@@ -0,0 +1,215 @@
+/*
+  Waveform.cpp - Square waves and pulse trains from the timer compare
+  outputs.  See Waveform.h for how to use it.
+*/
+#include "WProgram.h"
+#include "wiring_private.h"
+#include "pins_arduino.h"
+#include "Waveform.h"
+
+static const unsigned int timer1_prescales[] = { 1, 8, 64, 256, 1024 };
+static const unsigned int timer2_prescales[] = { 1, 8, 32, 64, 128, 256, 1024 };
+
+Waveform::Waveform() {
+  _timer = 0;
+  _playing = false;
+}
+
+int Waveform::begin(uint8_t pin) {
+  uint8_t timer = digitalPinToTimer(pin);
+  if (timer != TIMER1A && timer != TIMER2A)
+    return 1;
+  stop();
+  _pin = pin;
+  _timer = timer == TIMER1A ? 1 : 2;
+  // Low whenever the compare output is disconnected
+  digitalWrite(pin, LOW);
+  pinMode(pin, OUTPUT);
+  return 0;
+}
+
+/* Finds the prescaler and TOP giving the period nearest 1 / frequency,
+   where a period is steps * prescale * (TOP + 1) cycles: 2 for toggling on
+   compare, 1 for fast PWM. */
+int Waveform::solve(unsigned long frequency, uint8_t steps) {
+  const unsigned int *prescales = _timer == 1 ? timer1_prescales : timer2_prescales;
+  uint8_t count = _timer == 1 ? 5 : 7;
+  unsigned long max = _timer == 1 ? 0x10000UL : 0x100;
+  unsigned long best = 0xFFFFFFFFUL;
+
+  if (!frequency || frequency > F_CPU / steps)
+    return 1;
+  for (uint8_t i = 0; i < count; i++) {
+    unsigned long div = (unsigned long) steps * prescales[i] * frequency;
+    // Longer than a period even for TOP of 0: the rest are no better
+    if (div > F_CPU * 2)
+      break;
+    unsigned long counts = (F_CPU + div / 2) / div;
+    if (counts == 0 || counts > max)
+      continue;
+    // counts * div is the period made, times frequency, so compares
+    // with F_CPU as the period asked for does
+    unsigned long made = counts * div;
+    unsigned long error = made > F_CPU ? made - F_CPU : F_CPU - made;
+    if (error < best) {
+      best = error;
+      _cs = i + 1;
+      _prescale = prescales[i];
+      _top = counts - 1;
+    }
+  }
+  if (best == 0xFFFFFFFFUL)
+    return 1;
+  _steps = steps;
+  return 0;
+}
+
+void Waveform::connect() {
+  uint8_t oldSREG = SREG;
+  cli();
+  // The fault shutdown keeps the compare outputs off too
+  if (!pwm_locked) {
+    if (_timer == 2)
+      TCCR2A |= _BV(COM2A0);
+    else
+      TCCR1A |= _steps == 2 ? _BV(COM1A0) : _BV(COM1A1);
+  }
+  SREG = oldSREG;
+}
+
+void Waveform::disconnect() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (_timer == 2)
+    TCCR2A &= ~(_BV(COM2A1) | _BV(COM2A0));
+  else
+    TCCR1A &= ~(_BV(COM1A1) | _BV(COM1A0));
+  SREG = oldSREG;
+}
+
+void Waveform::start(unsigned long ms) {
+  _playing = true;
+  connect();
+  if (ms)
+    Timers.start(_end, ms, expire, this);
+}
+
+int Waveform::square(unsigned long frequency, unsigned long ms) {
+  if (!_timer)
+    return 1;
+  stop();
+  if (solve(frequency, 2))
+    return 1;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  // Stopped and in normal mode while TOP is written
+  if (_timer == 2) {
+    TCCR2B = 0;
+    TCCR2A = 0;
+    TCNT2 = 0;
+    OCR2A = _top;
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _cs;
+  } else {
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    OCR1A = _top;
+    TCCR1B = _BV(WGM12) | _cs;
+  }
+  SREG = oldSREG;
+
+  start(ms);
+  return 0;
+}
+
+int Waveform::pulses(unsigned long frequency, unsigned long width_us, unsigned long ms) {
+  if (_timer != 1)
+    return 1;
+  stop();
+  if (solve(frequency, 1))
+    return 1;
+  // width_us * cycles per us / prescale, split so it can't overflow
+  const unsigned long cycles_per_us = clockCyclesPerMicrosecond();
+  unsigned long width = width_us / _prescale * cycles_per_us +
+                        width_us % _prescale * cycles_per_us / _prescale;
+  if (width == 0 || width > _top)
+    return 1;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  TCCR1B = 0;
+  TCCR1A = 0;
+  TCNT1 = 0;
+  // High for OCR1A + 1 counts of every TOP + 1
+  OCR1A = width - 1;
+  ICR1 = _top;
+  // Mode 14, fast PWM with TOP in ICR1
+  TCCR1A = _BV(WGM11);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _cs;
+  SREG = oldSREG;
+
+  start(ms);
+  return 0;
+}
+
+int Waveform::burst(unsigned long frequency, unsigned long on_ms, unsigned long off_ms,
+                    unsigned long ms) {
+  if (square(frequency, ms))
+    return 1;
+  _on_ms = on_ms;
+  _off_ms = off_ms;
+  _on = true;
+  Timers.start(_gate, on_ms, gate, this);
+  return 0;
+}
+
+// Timer callback, switching a burst on and off
+void Waveform::gate(void *arg) {
+  Waveform *wave = (Waveform *) arg;
+  wave->_on = !wave->_on;
+  if (wave->_on)
+    wave->connect();
+  else
+    wave->disconnect();
+  Timers.start(wave->_gate, wave->_on ? wave->_on_ms : wave->_off_ms, gate, wave);
+}
+
+// Timer callback at the end of the duration
+void Waveform::expire(void *arg) {
+  ((Waveform *) arg)->stop();
+}
+
+void Waveform::stop() {
+  if (!_playing)
+    return;
+  Timers.cancel(_gate);
+  Timers.cancel(_end);
+  disconnect();
+
+  uint8_t oldSREG = SREG;
+  cli();
+  _playing = false;
+  if (_timer == 2) {
+    // 8-bit phase correct PWM at clk/64, as init() sets it
+    TCCR2B = 0;
+    TCCR2A = _BV(WGM20);
+    TCNT2 = 0;
+    OCR2A = 0;
+    TCCR2B = _BV(CS22);
+  }
+  SREG = oldSREG;
+  if (_timer == 1)
+    pwm16End();
+}
+
+boolean Waveform::playing() {
+  return _playing;
+}
+
+float Waveform::frequency() {
+  if (!_playing)
+    return 0;
+  return (float) F_CPU / _steps / _prescale / (_top + 1UL);
+}
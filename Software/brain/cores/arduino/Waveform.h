@@ -0,0 +1,78 @@
+/*
+  Waveform.h - Square waves and pulse trains from the timer compare
+  outputs, with no interrupt per edge.
+
+  tone() toggles its pin from a compare interrupt on every half period,
+  thousands of interrupts a second at audio frequencies.  Waveform puts
+  the timer in CTC mode with the compare output set to toggle, so the
+  hardware flips the pin by itself and the CPU is not involved at all
+  while the wave runs.  The compare value and prescaler are solved for
+  the closest frequency the timer can make, trying every prescaler.
+
+  Two outputs can be used: pin 13 (OC1A, Timer1, 16-bit) and pin 15
+  (OC2A, Timer2, 8-bit).  OC0A is the MCP2515 INT pin on this board, and
+  Timer0 keeps millis(), so it isn't offered.  Each output takes over its
+  whole timer: Timer1 from analogWrite() on 12 and 13, pwm16Begin() and
+  Capture; Timer2 from analogWrite() on 14 and 15 and tone().  stop() puts
+  the timer back as init() left it.
+
+    Waveform buzzer;
+    buzzer.begin(15);
+    buzzer.square(2400, 200);          // 2.4 kHz for 200 ms
+    buzzer.burst(2400, 100, 400, 0);   // beep 100 ms in every 500, forever
+
+  Durations and burst gating are timed by software timers on the Timers
+  wheel, so the only interrupt work is at the start and end of each
+  burst, on the millisecond tick that is running anyway.  They are good
+  to the millisecond; the waveform itself is exact to the clock.
+*/
+#ifndef Waveform_h
+#define Waveform_h
+
+#include <inttypes.h>
+#include "Timers.h"
+
+class Waveform
+{
+  public:
+    Waveform();
+    // Uses pin 13 or 15.  Returns 1 for any other pin.
+    int begin(uint8_t pin);
+    // 50% square wave at frequency Hz for ms milliseconds, or until stop()
+    // if ms is 0.  Returns 1 if the timer can't make the frequency.
+    int square(unsigned long frequency, unsigned long ms = 0);
+    // Pulses width_us long, frequency times a second, for ms milliseconds
+    // (0 for ever).  Pin 13 only, since it needs a TOP register apart from
+    // the compare.  Returns 1 if the timing can't be made.
+    int pulses(unsigned long frequency, unsigned long width_us, unsigned long ms = 0);
+    // Square wave at frequency, on for on_ms then off for off_ms, for ms
+    // milliseconds in all (0 for ever)
+    int burst(unsigned long frequency, unsigned long on_ms, unsigned long off_ms,
+              unsigned long ms = 0);
+    // Stops the output, leaving the pin low
+    void stop();
+    boolean playing();
+    // Of the wave being played, as made by the timer, in Hz
+    float frequency();
+  private:
+    static void gate(void *arg);
+    static void expire(void *arg);
+    int solve(unsigned long frequency, uint8_t steps);
+    void start(unsigned long ms);
+    void connect();
+    void disconnect();
+    uint8_t _pin;
+    uint8_t _timer;
+    uint8_t _cs;
+    unsigned int _prescale;
+    unsigned int _top;
+    uint8_t _steps;
+    volatile boolean _playing;
+    boolean _on;
+    unsigned long _on_ms;
+    unsigned long _off_ms;
+    Timer _gate;
+    Timer _end;
+};
+
+#endif
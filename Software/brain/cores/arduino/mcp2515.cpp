@@ -115,7 +115,10 @@ int Mcp2515::send(int length, int can_id, char * data)
 
 /* Receives CAN data from a channel, reads anywyas even if there are no messages ready */
 /* Note: expects channel = {0, 1} */
-int Mcp2515::receive(int channel, int * id, char * msg)
+/* If accept is given it is a bitmap of the 2048 standard IDs, bit (id & 7)
+   of byte (id >> 3).  A frame whose bit is clear is thrown away as soon as
+   its ID has been read, without reading the rest, and -1 is returned. */
+int Mcp2515::receive(int channel, int * id, char * msg, const unsigned char * accept)
 {
   *id = 0;
   // Choose correct channel to read from
@@ -127,6 +130,15 @@ int Mcp2515::receive(int channel, int * id, char * msg)
   // Highs and lows of Standard ID
   sid_h = SPI.transfer(0xAA);
   sid_l = SPI.transfer(0xAA);
+  if (accept) {
+    unsigned int temp_id = ((sid_h << 3) & 0x7F8) | ((sid_l >> 5) & 0x07);
+    if (!(accept[temp_id >> 3] & (1 << (temp_id & 0x07)))) {
+      SpiEnd();
+      *id = temp_id;
+      modify(CANINTF, (channel) ? 0x02 : 0x01, 0x00);
+      return -1;
+    }
+  }
   // We don't care about extended ID
   SPI.transfer(0xAA);
   SPI.transfer(0xAA);
@@ -146,7 +146,7 @@ class Mcp2515
     void write(char addr, char value);
     void modify(char addr, char mask, char data);
     int send(int length, int can_id, char * data);
-    int receive(int channel, int * id, char * msg);
+    int receive(int channel, int * id, char * msg, const unsigned char * accept = 0);
     char readStatus();
     char rxStatus();
   private:
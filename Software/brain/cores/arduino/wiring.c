@@ -22,21 +22,70 @@
   $Id: wiring.c 388 2008-03-08 22:05:23Z mellis $
 */
 
+#include <avr/sleep.h>
 #include "wiring_private.h"
 
+// timer 0 runs at clk/64 and overflows every 256 counts.  everything below
+// is worked out in cpu cycles so the conversions stay exact whenever F_CPU
+// is a whole number of kHz, not just at 8 and 16 MHz.
+#define TIMER0_PRESCALE 64UL
+#define CYCLES_PER_TIMER0_OVERFLOW (TIMER0_PRESCALE * 256UL)
+#define CYCLES_PER_MILLISECOND (F_CPU / 1000UL)
+
+// whole milliseconds, and the cycles left over, added per overflow.
+// the remainder is always below CYCLES_PER_MILLISECOND, so the ISR carries
+// at most one extra millisecond and never needs a loop.
+#define MILLIS_INC (CYCLES_PER_TIMER0_OVERFLOW / CYCLES_PER_MILLISECOND)
+#define FRACT_INC (CYCLES_PER_TIMER0_OVERFLOW % CYCLES_PER_MILLISECOND)
+
+/* micros() turns a cycle count below ~2 ms into microseconds with a
+   multiply and shift: us = (cycles * MICROS_MULT) >> MICROS_SHIFT, with
+   MICROS_MULT = 1000 * 2^MICROS_SHIFT / CYCLES_PER_MILLISECOND rounded up.
+   The shift is the largest that keeps the product in 32 bits for cycle
+   counts up to CYCLES_PER_MILLISECOND + 2 overflows.  At 8, 16 and 20 MHz
+   the result is exactly floor(cycles / cycles per microsecond). */
+#define MICROS_MAX_CYCLES (CYCLES_PER_MILLISECOND + 2 * CYCLES_PER_TIMER0_OVERFLOW)
+#define MICROS_RATIO (MICROS_MAX_CYCLES * 1000UL / CYCLES_PER_MILLISECOND + 1)
+#if MICROS_RATIO < 4096
+#define MICROS_SHIFT 20
+#elif MICROS_RATIO < 8192
+#define MICROS_SHIFT 19
+#elif MICROS_RATIO < 16384
+#define MICROS_SHIFT 18
+#elif MICROS_RATIO < 32768
+#define MICROS_SHIFT 17
+#else
+#define MICROS_SHIFT 16
+#endif
+#define MICROS_MULT (((1000UL << MICROS_SHIFT) + CYCLES_PER_MILLISECOND - 1) / CYCLES_PER_MILLISECOND)
+
 volatile unsigned long timer0_overflow_count = 0;
-volatile unsigned long timer0_clock_cycles = 0;
 volatile unsigned long timer0_millis = 0;
+// cycles since timer0_millis last ticked over
+volatile unsigned int timer0_fract = 0;
+// called at the end of every overflow once set; see wiring_private.h
+void (*volatile timer0_hook)(void) = 0;
 
 SIGNAL(TIMER0_OVF_vect)
 {
-	timer0_overflow_count++;
-	// timer 0 prescale factor is 64 and the timer overflows at 256
-	timer0_clock_cycles += 64UL * 256UL;
-	while (timer0_clock_cycles > clockCyclesPerMicrosecond() * 1000UL) {
-		timer0_clock_cycles -= clockCyclesPerMicrosecond() * 1000UL;
-		timer0_millis++;
+	// copy these to local variables so they can be stored in registers
+	// (volatile variables must be read from memory on every access)
+	unsigned long m = timer0_millis;
+	unsigned int f = timer0_fract;
+
+	m += MILLIS_INC;
+	f += FRACT_INC;
+	if (f >= CYCLES_PER_MILLISECOND) {
+		f -= CYCLES_PER_MILLISECOND;
+		m += 1;
 	}
+
+	timer0_fract = f;
+	timer0_millis = m;
+	timer0_overflow_count++;
+
+	if (timer0_hook)
+		timer0_hook();
 }
 
 unsigned long millis()
@@ -54,24 +103,176 @@ unsigned long millis()
 }
 
 unsigned long micros() {
-	unsigned long m, t;
+	unsigned long m;
+	unsigned int f, t;
 	uint8_t oldSREG = SREG;
 	
-	cli();	
+	cli();
+	m = timer0_millis;
+	f = timer0_fract;
 	t = TCNT0;
-  
+
+	// if the counter has overflowed but the interrupt hasn't run yet, the
+	// millisecond count is one overflow behind the counter.  (t == 255
+	// means the overflow flag belongs to the previous lap.)
 #ifdef TIFR0
-	if ((TIFR0 & _BV(TOV0)) && (t == 0))
-		t = 256;
+	if ((TIFR0 & _BV(TOV0)) && (t < 255))
+		t += 256;
 #else
-	if ((TIFR & _BV(TOV0)) && (t == 0))
-		t = 256;
+	if ((TIFR & _BV(TOV0)) && (t < 255))
+		t += 256;
 #endif
 
+	SREG = oldSREG;
+
+	// the cycles since the last whole millisecond fit in 16 bits
+	unsigned int cycles = f + t * TIMER0_PRESCALE;
+	return m * 1000UL + ((cycles * MICROS_MULT) >> MICROS_SHIFT);
+}
+
+/* Returns the free-running timer 0 count: one tick every TICK_CYCLES cpu
+   cycles.  Cheaper than micros() and exact, so it is the right thing for
+   timing short sections; convert with ticksToMicroseconds(). */
+unsigned long timerTicks()
+{
+	unsigned long m;
+	uint8_t t;
+	uint8_t oldSREG = SREG;
+
+	cli();
 	m = timer0_overflow_count;
+	t = TCNT0;
+#ifdef TIFR0
+	if ((TIFR0 & _BV(TOV0)) && (t < 255))
+		m++;
+#else
+	if ((TIFR & _BV(TOV0)) && (t < 255))
+		m++;
+#endif
 	SREG = oldSREG;
-	
-	return ((m << 8) + t) * (64 / clockCyclesPerMicrosecond());
+
+	return (m << 8) + t;
+}
+
+/* A whole number of milliseconds is always a whole number of ticks, and
+   TICK_CHUNK ticks make TICK_CHUNK_MS of them, with no cycles over.  The
+   tick conversions take whole chunks with one divide and convert what is
+   left, under TICK_CHUNK_MS, with the micros() multiply and shift, so
+   they are exact (rounded down) over the whole 32-bit range without
+   floating point.  TICK_CHUNK is 625 (2 ms) at 20 MHz, 250 (1 ms) at 8
+   and 16 MHz. */
+#if CYCLES_PER_MILLISECOND % 64 == 0
+#define TICK_CHUNK_MS 1UL
+#elif CYCLES_PER_MILLISECOND % 32 == 0
+#define TICK_CHUNK_MS 2UL
+#elif CYCLES_PER_MILLISECOND % 16 == 0
+#define TICK_CHUNK_MS 4UL
+#elif CYCLES_PER_MILLISECOND % 8 == 0
+#define TICK_CHUNK_MS 8UL
+#elif CYCLES_PER_MILLISECOND % 4 == 0
+#define TICK_CHUNK_MS 16UL
+#elif CYCLES_PER_MILLISECOND % 2 == 0
+#define TICK_CHUNK_MS 32UL
+#else
+#define TICK_CHUNK_MS 64UL
+#endif
+#define TICK_CHUNK (TICK_CHUNK_MS * CYCLES_PER_MILLISECOND / TICK_CYCLES)
+#if TICK_CHUNK_MS * CYCLES_PER_MILLISECOND > MICROS_MAX_CYCLES
+#error "ticksToMicroseconds() has no exact conversion for this F_CPU"
+#endif
+
+unsigned long ticksToMicroseconds(unsigned long ticks)
+{
+	unsigned long chunks = ticks / TICK_CHUNK;
+	unsigned long cycles = (ticks - chunks * TICK_CHUNK) * TICK_CYCLES;
+
+	return chunks * (TICK_CHUNK_MS * 1000UL) + ((cycles * MICROS_MULT) >> MICROS_SHIFT);
+}
+
+unsigned long microsecondsToTicks(unsigned long us)
+{
+	unsigned long chunks = us / (TICK_CHUNK_MS * 1000UL);
+	unsigned long left = us - chunks * (TICK_CHUNK_MS * 1000UL);
+
+	// left is under TICK_CHUNK_MS ms, so left * TICK_CHUNK fits easily
+	return chunks * TICK_CHUNK + left * TICK_CHUNK / (TICK_CHUNK_MS * 1000UL);
+}
+
+// timer 0 ticks spent asleep since idlePercent() was last called, and the
+// tick count when it was called
+static unsigned long idle_ticks = 0;
+static unsigned long idle_window_start = 0;
+
+/* Stops the cpu in idle sleep until the next interrupt, which is never
+ * more than one timer 0 overflow away.  Everything but the cpu keeps
+ * running.  Interrupts are enabled on return: a caller can disable them,
+ * check there is nothing to do, and call idle() without missing a wake up,
+ * because the sleep instruction always runs before a pending interrupt. */
+void idle()
+{
+	unsigned long start = timerTicks();
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	// includes the interrupt that woke us, which is close enough
+	idle_ticks += timerTicks() - start;
+}
+
+/* Returns the percentage of time spent in idle() or powerSave() since the
+ * last call. */
+unsigned char idlePercent()
+{
+	unsigned long now = timerTicks();
+	unsigned long total = now - idle_window_start;
+	unsigned long slept = idle_ticks;
+
+	idle_window_start = now;
+	idle_ticks = 0;
+
+	if (total == 0)
+		return 0;
+	// keep slept * 100 in 32 bits
+	while (total > 0xFFFFFFUL) {
+		total >>= 1;
+		slept >>= 1;
+	}
+	return slept * 100 / total;
+}
+
+// milliseconds timer0Advance() moves the clock on with interrupts off at a
+// time.  A long sleep is caught up in steps of this, so the software
+// timers run in order without holding off the CAN interrupt for the whole
+// backlog; step * CYCLES_PER_MILLISECOND also stays well inside 32 bits.
+#define ADVANCE_STEP_MS 8
+
+// cycles asleep not yet counted as a timer 0 overflow
+static unsigned int advance_fract = 0;
+
+/* Moves the clock on by ms while timer 0 was stopped in power-save sleep,
+ * and runs the software timers that came due in the meantime.  Interrupts
+ * get a look in between steps, if they were on. */
+void timer0Advance(unsigned long ms)
+{
+	while (ms) {
+		uint8_t step = ms > ADVANCE_STEP_MS ? ADVANCE_STEP_MS : ms;
+		unsigned long cycles = step * CYCLES_PER_MILLISECOND + advance_fract;
+		unsigned long overflows = cycles / CYCLES_PER_TIMER0_OVERFLOW;
+		uint8_t oldSREG = SREG;
+
+		advance_fract = cycles % CYCLES_PER_TIMER0_OVERFLOW;
+		cli();
+		timer0_millis += step;
+		timer0_overflow_count += overflows;
+		idle_ticks += overflows << 8;
+		if (timer0_hook)
+			timer0_hook();
+		SREG = oldSREG;
+		ms -= step;
+	}
 }
 
 void delay(unsigned long ms)
@@ -79,55 +280,38 @@ void delay(unsigned long ms)
 	unsigned long start = millis();
 	
 	while (millis() - start <= ms)
-		;
+		idle();
 }
 
-/* Delay for the given number of microseconds.  Assumes a 8 or 16 MHz clock. 
- * Disables interrupts, which will disrupt the millis() function if used
- * too frequently. */
+// cycles spent in delayMicroseconds() outside the busy loop: the call,
+// the multiply and the bookkeeping (an estimate for -Os code).
+#define DELAY_OVERHEAD_CYCLES 28
+
+// busy loop iterations (4 cycles each) per microsecond, in 24.8 fixed point
+#define DELAY_LOOPS_PER_US_Q8 ((F_CPU * 256UL + 2000000UL) / 4000000UL)
+
+/* Delay for the given number of microseconds, calibrated from F_CPU.
+ * Disables interrupts for delays under a millisecond so the timing isn't
+ * stretched by an ISR; longer delays leave interrupts on (and so don't
+ * lose timer 0 overflows) and spin on micros() instead. */
 void delayMicroseconds(unsigned int us)
 {
 	uint8_t oldSREG;
+	unsigned long loops;
 
-	// calling avrlib's delay_us() function with low values (e.g. 1 or
-	// 2 microseconds) gives delays longer than desired.
-	//delay_us(us);
-
-#if F_CPU >= 16000000L
-	// for the 16 MHz clock on most Arduino boards
-
-	// for a one-microsecond delay, simply return.  the overhead
-	// of the function call yields a delay of approximately 1 1/8 us.
-	if (--us == 0)
+	if (us >= 1000) {
+		unsigned long start = micros();
+		while (micros() - start < us)
+			;
 		return;
+	}
 
-	// the following loop takes a quarter of a microsecond (4 cycles)
-	// per iteration, so execute it four times for each microsecond of
-	// delay requested.
-	us <<= 2;
-
-	// account for the time taken in the preceeding commands.
-	us -= 2;
-#else
-	// for the 8 MHz internal clock on the ATmega168
-
-	// for a one- or two-microsecond delay, simply return.  the overhead of
-	// the function calls takes more than two microseconds.  can't just
-	// subtract two, since us is unsigned; we'd overflow.
-	if (--us == 0)
+	// work out the loop count and take off what the call itself costs.
+	// for very short delays the overhead is already the whole delay.
+	loops = ((unsigned long) us * DELAY_LOOPS_PER_US_Q8) >> 8;
+	if (loops <= DELAY_OVERHEAD_CYCLES / 4)
 		return;
-	if (--us == 0)
-		return;
-
-	// the following loop takes half of a microsecond (4 cycles)
-	// per iteration, so execute it twice for each microsecond of
-	// delay requested.
-	us <<= 1;
-
-	// partially compensate for the time taken by the preceeding commands.
-	// we can't subtract any more than this or we'd overflow w/ small delays.
-	us--;
-#endif
+	us = loops - DELAY_OVERHEAD_CYCLES / 4;
 
 	// disable interrupts, otherwise the timer 0 overflow interrupt that
 	// tracks milliseconds will make us delay longer than we want.
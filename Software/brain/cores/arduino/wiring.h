@@ -26,6 +26,7 @@
 #define Wiring_h
 
 #include <avr/io.h>
+#include <stddef.h>
 #include "binary.h"
 
 #ifdef __cplusplus
@@ -82,6 +83,9 @@ extern "C"{
 #define clockCyclesToMicroseconds(a) ( (a) / clockCyclesPerMicrosecond() )
 #define microsecondsToClockCycles(a) ( (a) * clockCyclesPerMicrosecond() )
 
+// timerTicks() counts once every TICK_CYCLES cpu cycles
+#define TICK_CYCLES 64UL
+
 #define lowByte(w) ((w) & 0xff)
 #define highByte(w) ((w) >> 8)
 
@@ -105,15 +109,24 @@ int digitalRead(uint8_t);
 int analogRead(uint8_t);
 void analogReference(uint8_t mode);
 void analogWrite(uint8_t, int);
+void pwmShutdown(void);
+void pwmUnlock(void);
 
 void beginSerial(uint8_t, long);
 void serialWrite(uint8_t, unsigned char);
+void serialWriteBuffer(uint8_t, const unsigned char *, size_t);
 int serialAvailable(uint8_t);
 int serialRead(uint8_t);
 void serialFlush(uint8_t);
 
 unsigned long millis(void);
 unsigned long micros(void);
+unsigned long timerTicks(void);
+unsigned long ticksToMicroseconds(unsigned long ticks);
+unsigned long microsecondsToTicks(unsigned long us);
+void idle(void);
+unsigned char idlePercent(void);
+unsigned long powerSave(unsigned long ms);
 void delay(unsigned long);
 void delayMicroseconds(unsigned int us);
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout);
@@ -122,6 +135,10 @@ void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, byte val);
 
 void attachInterrupt(uint8_t, void (*)(void), int mode);
 void detachInterrupt(uint8_t);
+void attachPinChangeInterrupt(uint8_t pin, void (*)(void), int mode);
+void detachPinChangeInterrupt(uint8_t pin);
+void suspendPinChangeInterrupt(uint8_t pin);
+void resumePinChangeInterrupt(uint8_t pin);
 
 void setup(void);
 void loop(void);
@@ -24,8 +24,10 @@
 
 #include "wiring_private.h"
 #include "pins_arduino.h"
+#include "FastPin.h"
 
 uint8_t analog_reference = DEFAULT;
+volatile uint8_t pwm_locked = 0;
 
 void analogReference(uint8_t mode)
 {
@@ -77,6 +79,12 @@ void analogWrite(uint8_t pin, int val)
 	// for consistenty with Wiring, which doesn't require a pinMode
 	// call for the analog output pins.
 	pinMode(pin, OUTPUT);
+
+	// After pwmShutdown() the PWM outputs stay off until pwmUnlock()
+	if (pwm_locked && digitalPinToTimer(pin) != NOT_ON_TIMER) {
+		digitalWrite(pin, LOW);
+		return;
+	}
 	
 	if (digitalPinToTimer(pin) == TIMER1A) {
 		// connect pwm to pin on timer 1, channel A
@@ -114,3 +122,42 @@ void analogWrite(uint8_t pin, int val)
 	else
 		digitalWrite(pin, HIGH);
 }
+
+/* Disconnects every timer PWM output that is connected and drives its pin
+ * low, and stops analogWrite() connecting them again until pwmUnlock().  A
+ * disconnected output falls back to its PORT bit, so the bit is cleared
+ * first.  Pins whose COM bits are clear are left alone: pins 3 and 4 are
+ * normally the MCP2515 INT and chip select, and driving the chip select
+ * low would break a CAN transfer in progress.  Safe to call from an
+ * interrupt; for fault handlers, where every cycle counts, it is all
+ * single register operations. */
+void pwmShutdown(void)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	pwm_locked = 1;
+	// COMnA is bits 7:6 of TCCRnA and COMnB bits 5:4
+	if (TCCR0A & 0xC0)
+		digitalWriteFast(3, LOW);
+	if (TCCR0A & 0x30)
+		digitalWriteFast(4, LOW);
+	if (TCCR1A & 0xC0)
+		digitalWriteFast(13, LOW);
+	if (TCCR1A & 0x30)
+		digitalWriteFast(12, LOW);
+	if (TCCR2A & 0xC0)
+		digitalWriteFast(15, LOW);
+	if (TCCR2A & 0x30)
+		digitalWriteFast(14, LOW);
+	TCCR0A &= 0x0F;
+	TCCR1A &= 0x0F;
+	TCCR2A &= 0x0F;
+	SREG = oldSREG;
+}
+
+/* Lets analogWrite() drive the PWM outputs again.  Outputs stay off until
+ * the next analogWrite() on each pin. */
+void pwmUnlock(void)
+{
+	pwm_locked = 0;
+}
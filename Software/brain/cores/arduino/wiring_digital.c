@@ -30,14 +30,20 @@ void pinMode(uint8_t pin, uint8_t mode)
 	uint8_t bit = digitalPinToBitMask(pin);
 	uint8_t port = digitalPinToPort(pin);
 	volatile uint8_t *reg;
+	uint8_t oldSREG;
 
 	if (port == NOT_A_PIN) return;
 
 	// JWS: can I let the optimizer do this?
 	reg = portModeRegister(port);
 
+	// the read-modify-write must not be interrupted by an ISR that changes
+	// another pin on the same port
+	oldSREG = SREG;
+	cli();
 	if (mode == INPUT) *reg &= ~bit;
 	else *reg |= bit;
+	SREG = oldSREG;
 }
 
 // Forcing this inline keeps the callers from having to push their own stuff
@@ -64,6 +70,7 @@ void digitalWrite(uint8_t pin, uint8_t val)
 	uint8_t bit = digitalPinToBitMask(pin);
 	uint8_t port = digitalPinToPort(pin);
 	volatile uint8_t *out;
+	uint8_t oldSREG;
 
 	if (port == NOT_A_PIN) return;
 
@@ -73,8 +80,11 @@ void digitalWrite(uint8_t pin, uint8_t val)
 
 	out = portOutputRegister(port);
 
+	oldSREG = SREG;
+	cli();
 	if (val == LOW) *out &= ~bit;
 	else *out |= bit;
+	SREG = oldSREG;
 }
 
 int digitalRead(uint8_t pin)
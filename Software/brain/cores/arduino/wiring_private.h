@@ -53,6 +53,16 @@ extern "C"{
 
 typedef void (*voidFuncPtr)(void);
 
+// Called from the timer 0 overflow interrupt, after millis() has been
+// updated, whenever it is non-zero.  Used by the software timers.
+extern void (*volatile timer0_hook)(void);
+extern volatile unsigned long timer0_millis;
+// set by analogReference(), the REFS bits for ADMUX
+extern uint8_t analog_reference;
+// set by pwmShutdown(), keeps analogWrite() from driving the PWM outputs
+extern volatile uint8_t pwm_locked;
+void timer0Advance(unsigned long ms);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
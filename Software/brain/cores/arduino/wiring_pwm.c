@@ -0,0 +1,125 @@
+/*
+  wiring_pwm.c - Timer1 PWM at any frequency, see Pwm16.h
+*/
+
+#include "wiring_private.h"
+#include "pins_arduino.h"
+#include "Pwm16.h"
+
+unsigned int pwm16_top = 255;
+
+static const unsigned int prescales[] = { 1, 8, 64, 256, 1024 };
+
+/* Sets Timer1 running at the frequency nearest the one given, in the
+ * given mode, and returns the frequency actually set, in whole Hz
+ * rounded down.  Returns 0,
+ * leaving Timer1 alone, if the frequency can't be had with at least two
+ * bits of duty.  Outputs that are connected stay connected; both duties
+ * start at 0. */
+unsigned long pwm16Begin(unsigned long frequency, uint8_t mode)
+{
+	// Timer clocks per period: TOP + 1 for fast PWM, 2 * TOP for phase
+	// and frequency correct
+	uint8_t steps = mode == PWM_EDGE ? 1 : 2;
+	unsigned long top = 0;
+	uint8_t cs;
+	uint8_t oldSREG;
+
+	if (frequency == 0)
+		return 0;
+	for (cs = 0; cs < 5; cs++) {
+		unsigned long rate = F_CPU / prescales[cs];
+		unsigned long div = steps * frequency;
+		top = (rate + div / 2) / div;
+		if (mode == PWM_EDGE)
+			top--;
+		if (top <= 0xFFFF)
+			break;
+	}
+	if (cs == 5 || top < 3)
+		return 0;
+
+	oldSREG = SREG;
+	cli();
+	// Stop, and drop to normal mode so the compare registers are written
+	// straight through instead of waiting for a BOTTOM that never comes
+	TCCR1B = 0;
+	TCCR1A &= _BV(COM1A1) | _BV(COM1B1);
+	TCNT1 = 0;
+	OCR1A = 0;
+	OCR1B = 0;
+	ICR1 = top;
+	pwm16_top = top;
+	if (mode == PWM_EDGE) {
+		// Mode 14, fast PWM with TOP in ICR1
+		TCCR1A |= _BV(WGM11);
+		TCCR1B = _BV(WGM13) | _BV(WGM12) | (cs + 1);
+	} else {
+		// Mode 8, phase and frequency correct with TOP in ICR1
+		TCCR1B = _BV(WGM13) | (cs + 1);
+	}
+	SREG = oldSREG;
+
+	return F_CPU / prescales[cs] / (mode == PWM_EDGE ? top + 1 : 2 * top);
+}
+
+/* Puts Timer1 back as init() sets it up for analogWrite() */
+void pwm16End(void)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+	TCCR1B = 0;
+	TCCR1A &= _BV(COM1A1) | _BV(COM1B1);
+	TCNT1 = 0;
+	OCR1A = 0;
+	OCR1B = 0;
+	ICR1 = 0;
+	pwm16_top = 255;
+	TCCR1A |= _BV(WGM10);
+	TCCR1B = _BV(CS11) | _BV(CS10);
+	SREG = oldSREG;
+}
+
+/* Drives pin 13 (OC1A) or 12 (OC1B) from Timer1.  digitalWrite() on the
+ * pin disconnects it again, as it does after analogWrite().  Does nothing
+ * while pwmShutdown() has the outputs locked off. */
+void pwm16Connect(uint8_t pin)
+{
+	uint8_t timer = digitalPinToTimer(pin);
+	uint8_t oldSREG;
+
+	if ((timer != TIMER1A && timer != TIMER1B) || pwm_locked)
+		return;
+	pinMode(pin, OUTPUT);
+	oldSREG = SREG;
+	cli();
+	TCCR1A |= timer == TIMER1A ? _BV(COM1A1) : _BV(COM1B1);
+	SREG = oldSREG;
+}
+
+void pwm16Disconnect(uint8_t pin)
+{
+	uint8_t timer = digitalPinToTimer(pin);
+	uint8_t oldSREG;
+
+	if (timer != TIMER1A && timer != TIMER1B)
+		return;
+	oldSREG = SREG;
+	cli();
+	TCCR1A &= timer == TIMER1A ? ~_BV(COM1A1) : ~_BV(COM1B1);
+	SREG = oldSREG;
+}
+
+/* Sets the duty for a pin, clamped to pwm16Top().  For speed when the
+ * channel is known, use pwm16WriteA() or pwm16WriteB(). */
+void pwm16Write(uint8_t pin, unsigned int duty)
+{
+	uint8_t timer = digitalPinToTimer(pin);
+
+	if (duty > pwm16_top)
+		duty = pwm16_top;
+	if (timer == TIMER1A)
+		pwm16WriteA(duty);
+	else if (timer == TIMER1B)
+		pwm16WriteB(duty);
+}
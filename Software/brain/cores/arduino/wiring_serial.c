@@ -88,6 +88,27 @@ void serialWrite(uint8_t uart, unsigned char c)
 #endif
 }
 
+// Sends a whole buffer.  The UART is picked once for the chunk rather than
+// once per byte, and the inner loop is just the UDRE poll and the store.
+#define SERIAL_WRITE_BUFFER(uart_, buf_, len_) \
+    while (len_--) { \
+      while (!(UCSR##uart_##A & (1 << UDRE##uart_))) \
+        ; \
+      UDR##uart_ = *buf_++; \
+    }
+
+void serialWriteBuffer(uint8_t uart, const unsigned char *buf, size_t len)
+{
+  if (uart == 0) {
+    SERIAL_WRITE_BUFFER(0, buf, len);
+  }
+#if defined(__AVR_ATmega644P__) || defined(__AVR_ATmega324P__)
+  else {
+    SERIAL_WRITE_BUFFER(1, buf, len);
+  }
+#endif
+}
+
 int serialAvailable(uint8_t uart)
 {
   return (RX_BUFFER_SIZE + rx_buffer_head[uart] - rx_buffer_tail[uart]) % RX_BUFFER_SIZE;
@@ -0,0 +1,94 @@
+/*
+  wiring_sleep.c - power-save sleep timed by the watchdog
+
+  Kept apart from wiring.c so that the watchdog interrupt is only taken
+  by sketches that use powerSave().
+*/
+
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "wiring_private.h"
+
+static volatile uint8_t wdt_fired;
+
+ISR(WDT_vect)
+{
+	wdt_fired = 1;
+}
+
+/* Changes the watchdog setup.  The new value has to be stored within four
+ * cycles of setting WDCE, so both stores are in assembler, as in avr-libc's
+ * wdt_enable(), where the compiler can't put anything between them.  Call
+ * with interrupts off. */
+static void wdtWrite(uint8_t value)
+{
+	wdt_reset();
+	// WDE can't be cleared while WDRF is set
+	MCUSR &= ~_BV(WDRF);
+	__asm__ __volatile__ (
+		"sts %0, %1" "\n\t"
+		"sts %0, %2" "\n\t"
+		: /* no outputs */
+		: "n" (_SFR_MEM_ADDR(WDTCSR)),
+		  "r" ((uint8_t) (_BV(WDCE) | _BV(WDE))),
+		  "r" (value)
+		: "memory");
+}
+
+/* Sleeps in power-save mode for up to ms milliseconds and returns how long
+ * it slept.  Only the watchdog and asynchronous wake ups run, so this
+ * draws far less than idle(), but timer 0 stops: millis() is moved on by
+ * the watchdog periods slept instead, which are only good to about 10%.
+ *
+ * Any enabled pin change or external interrupt ends the sleep early; the
+ * CAN INT pin change does so once CanBufferInit() has enabled it.  The part
+ * of the watchdog period before an early wake up is not counted, so keep
+ * ms short if millis() matters across wake ups.  The UART cannot wake the
+ * chip from this mode.  Sleeps under 16 ms return at once.
+ *
+ * powerSave() borrows the watchdog to time the sleep.  If the sketch had
+ * the watchdog running, it is off while asleep and set back up as it was
+ * afterwards, with its count restarted. */
+unsigned long powerSave(unsigned long ms)
+{
+	unsigned long slept = 0;
+	uint8_t oldSREG = SREG;
+	// the sketch's own watchdog setup, without the interrupt flag
+	uint8_t saved = WDTCSR & (_BV(WDIE) | _BV(WDE) | _BV(WDP3) | 0x07);
+
+	while (ms - slept >= 16) {
+		// the watchdog periods are 16 ms << 0..9
+		unsigned long left = ms - slept;
+		uint8_t p = 9;
+		uint8_t wdtcsr;
+		while ((16UL << p) > left)
+			p--;
+		// worked out before the timed sequence, not in the middle of it
+		wdtcsr = _BV(WDIE) | (p & 7) | ((p & 8) ? _BV(WDP3) : 0);
+
+		cli();
+		wdt_fired = 0;
+		wdtWrite(wdtcsr);
+
+		set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+
+		cli();
+		wdtWrite(0);
+		SREG = oldSREG;
+
+		if (!wdt_fired)
+			break;
+		timer0Advance(16UL << p);
+		slept += 16UL << p;
+	}
+	if (saved) {
+		cli();
+		wdtWrite(saved);
+		SREG = oldSREG;
+	}
+	return slept;
+}
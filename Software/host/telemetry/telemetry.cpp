@@ -0,0 +1,307 @@
+/*
+  telemetry.cpp - Host side decoder for the BRAIN binary telemetry stream.
+*/
+#include "telemetry.h"
+
+#include <string.h>
+
+namespace telemetry {
+
+// Same as avr-libc's _crc_ccitt_update, applied over a buffer.
+uint16_t crc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    uint8_t d = *data++;
+    d ^= crc & 0xFF;
+    d ^= d << 4;
+    crc = ((((uint16_t) d << 8) | (crc >> 8)) ^ (uint8_t) (d >> 4) ^
+           ((uint16_t) d << 3));
+  }
+  return crc;
+}
+
+static uint32_t readLe(const uint8_t *p, size_t n) {
+  uint32_t v = 0;
+  while (n--)
+    v = (v << 8) | p[n];
+  return v;
+}
+
+// FrameDecoder ///////////////////////////////////////////////////////////////
+
+FrameDecoder::FrameDecoder(Callback callback, void *context)
+  : _callback(callback), _context(context), _len(0), _overrun(false),
+    _have_seq(false), _last_seq(0) {
+}
+
+void FrameDecoder::feed(const uint8_t *data, size_t len) {
+  _stats.bytes += len;
+  const uint8_t *end = data + len;
+  while (data < end) {
+    // Copy up to the next delimiter in one go
+    const uint8_t *zero = (const uint8_t *) memchr(data, 0, end - data);
+    const uint8_t *stop = zero ? zero : end;
+    size_t n = stop - data;
+    if (_len + n > sizeof(_buf)) {
+      _overrun = true;
+      n = sizeof(_buf) - _len;
+    }
+    memcpy(_buf + _len, data, n);
+    _len += n;
+    data = stop;
+    if (zero) {
+      finishFrame();
+      data++;
+    }
+  }
+}
+
+void FrameDecoder::finishFrame() {
+  size_t len = _len;
+  bool overrun = _overrun;
+  _len = 0;
+  _overrun = false;
+  if (len == 0)
+    return;  // back to back delimiters, or the start of a capture
+  if (overrun) {
+    _stats.framing_errors++;
+    return;
+  }
+
+  // COBS decode in place: each code byte says how far away the next zero
+  // is.  Frames never need a 0xFF block, so every code byte stands for a
+  // zero except the final one.
+  uint8_t *frame = _buf;
+  size_t out = 0;
+  size_t i = 0;
+  while (i < len) {
+    uint8_t code = _buf[i];
+    if (code == 0 || i + code > len) {
+      _stats.framing_errors++;
+      return;
+    }
+    memmove(frame + out, _buf + i + 1, code - 1);
+    out += code - 1;
+    i += code;
+    if (i < len)
+      frame[out++] = 0;
+  }
+
+  if (out < kHeaderLen + kCrcLen) {
+    _stats.framing_errors++;
+    return;
+  }
+  size_t body = out - kCrcLen;
+  if (crc16(frame, body) != readLe(frame + body, kCrcLen)) {
+    _stats.crc_errors++;
+    return;
+  }
+
+  Frame f;
+  f.id = frame[0];
+  f.seq = frame[1];
+  f.millis = readLe(frame + 2, 4);
+  f.fields = frame + kHeaderLen;
+  f.fields_len = body - kHeaderLen;
+
+  if (_have_seq)
+    _stats.lost_frames += (uint8_t) (f.seq - _last_seq - 1);
+  _have_seq = true;
+  _last_seq = f.seq;
+  _stats.frames++;
+  _callback(f, _context);
+}
+
+// Schema /////////////////////////////////////////////////////////////////////
+
+static bool parseType(const std::string &name, FieldType *type, size_t *size) {
+  static const struct { const char *name; FieldType type; size_t size; } types[] = {
+    { "i8", I8, 1 }, { "u8", U8, 1 }, { "i16", I16, 2 }, { "u16", U16, 2 },
+    { "i32", I32, 4 }, { "u32", U32, 4 }, { "f32", F32, 4 },
+  };
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    if (name == types[i].name) {
+      *type = types[i].type;
+      *size = types[i].size;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Schema::parse(const std::string &descriptor) {
+  _fields.clear();
+  _descriptor = descriptor;
+  _size = 0;
+  size_t start = 0;
+  while (start <= descriptor.size()) {
+    size_t comma = descriptor.find(',', start);
+    if (comma == std::string::npos)
+      comma = descriptor.size();
+    std::string item = descriptor.substr(start, comma - start);
+    size_t colon = item.find(':');
+    if (colon == std::string::npos || colon == 0)
+      return false;
+    Field field;
+    size_t size;
+    field.name = item.substr(0, colon);
+    if (!parseType(item.substr(colon + 1), &field.type, &size))
+      return false;
+    _fields.push_back(field);
+    _size += size;
+    start = comma + 1;
+  }
+  return true;
+}
+
+// Recorder ///////////////////////////////////////////////////////////////////
+
+Recorder::Recorder() : _decoder(&Recorder::onFrame, this) {
+}
+
+Recorder::~Recorder() {
+  for (size_t i = 0; i < _tables.size(); i++)
+    delete _tables[i];
+}
+
+void Recorder::onFrame(const Frame &frame, void *context) {
+  static_cast<Recorder *>(context)->handleFrame(frame);
+}
+
+void Recorder::handleFrame(const Frame &frame) {
+  Stats &stats = _decoder.stats();
+
+  if (frame.id == kSchemaId) {
+    if (frame.fields_len < 1) {
+      stats.bad_records++;
+      return;
+    }
+    uint8_t id = frame.fields[0];
+    std::string descriptor((const char *) frame.fields + 1, frame.fields_len - 1);
+    Table *current = _current.count(id) ? _current[id] : 0;
+    if (current && current->schema.descriptor() == descriptor)
+      return;  // periodic resend
+    Table *table = new Table;
+    if (!table->schema.parse(descriptor)) {
+      delete table;
+      stats.bad_records++;
+      return;
+    }
+    table->id = id;
+    table->version = current ? current->version + 1 : 0;
+    table->columns.resize(table->schema.fields().size());
+    _tables.push_back(table);
+    _current[id] = table;
+    return;
+  }
+
+  std::map<uint8_t, Table *>::iterator it = _current.find(frame.id);
+  if (it == _current.end()) {
+    stats.unknown_records++;
+    return;
+  }
+  Table *table = it->second;
+  if (frame.fields_len != table->schema.recordSize()) {
+    stats.bad_records++;
+    return;
+  }
+
+  table->millis.push_back(frame.millis);
+  table->seq.push_back(frame.seq);
+  const uint8_t *p = frame.fields;
+  const std::vector<Field> &fields = table->schema.fields();
+  for (size_t i = 0; i < fields.size(); i++) {
+    double v = 0;
+    switch (fields[i].type) {
+      case I8:  v = (int8_t) p[0]; p += 1; break;
+      case U8:  v = p[0]; p += 1; break;
+      case I16: v = (int16_t) readLe(p, 2); p += 2; break;
+      case U16: v = (uint16_t) readLe(p, 2); p += 2; break;
+      case I32: v = (int32_t) readLe(p, 4); p += 4; break;
+      case U32: v = readLe(p, 4); p += 4; break;
+      case F32: {
+        uint32_t bits = readLe(p, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        v = f;
+        p += 4;
+        break;
+      }
+    }
+    table->columns[i].push_back(v);
+  }
+}
+
+bool Recorder::writeCsv(const std::string &prefix) const {
+  for (size_t i = 0; i < _tables.size(); i++) {
+    const Table &table = *_tables[i];
+    char name[32];
+    if (table.version)
+      snprintf(name, sizeof(name), "_%u_v%u.csv", table.id, table.version);
+    else
+      snprintf(name, sizeof(name), "_%u.csv", table.id);
+    std::string path = prefix + name;
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out)
+      return false;
+    bool ok = telemetry::writeCsv(table, out);
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+// Formats an unsigned integer, returns the number of characters written.
+static size_t formatUnsigned(char *out, uint32_t v) {
+  char tmp[10];
+  size_t n = 0;
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  for (size_t i = 0; i < n; i++)
+    out[i] = tmp[n - 1 - i];
+  return n;
+}
+
+bool writeCsv(const Table &table, FILE *out) {
+  const std::vector<Field> &fields = table.schema.fields();
+  fputs("millis,seq", out);
+  for (size_t c = 0; c < fields.size(); c++) {
+    fputc(',', out);
+    fputs(fields[c].name.c_str(), out);
+  }
+  fputc('\n', out);
+
+  // Rows are built in a large buffer and written in blocks; stdio per
+  // value is the slow part of dumping hours of logs.
+  std::vector<char> buf(1 << 16);
+  size_t len = 0;
+  for (size_t r = 0; r < table.rows(); r++) {
+    if (buf.size() - len < 32 * (fields.size() + 2)) {
+      fwrite(&buf[0], 1, len, out);
+      len = 0;
+    }
+    len += formatUnsigned(&buf[len], table.millis[r]);
+    buf[len++] = ',';
+    len += formatUnsigned(&buf[len], table.seq[r]);
+    for (size_t c = 0; c < fields.size(); c++) {
+      double v = table.columns[c][r];
+      buf[len++] = ',';
+      if (fields[c].type == F32) {
+        len += snprintf(&buf[len], 32, "%.9g", v);
+      } else if (v < 0) {
+        buf[len++] = '-';
+        len += formatUnsigned(&buf[len], (uint32_t) -v);
+      } else {
+        len += formatUnsigned(&buf[len], (uint32_t) v);
+      }
+    }
+    buf[len++] = '\n';
+  }
+  fwrite(&buf[0], 1, len, out);
+  return !ferror(out);
+}
+
+}  // namespace telemetry
@@ -0,0 +1,126 @@
+/*
+  telemetry.h - Host side decoder for the BRAIN binary telemetry stream.
+
+  The stream format is described in brain/cores/arduino/Telemetry.h: COBS
+  frames separated by 0x00, each holding a record id, sequence number,
+  millis() timestamp, packed fields and a CRC-16/CCITT.  Schema frames
+  (record id 0) carry the field names and types for the other ids.
+
+  FrameDecoder splits a byte stream into checked frames.  Schema parses a
+  descriptor.  Recorder ties the two together and keeps every record type
+  as a table of columns that can be written out as CSV.
+*/
+#ifndef Telemetry_Host_h
+#define Telemetry_Host_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace telemetry {
+
+const uint8_t kSchemaId = 0;
+const size_t kHeaderLen = 6;   // id, sequence, millis
+const size_t kCrcLen = 2;
+const size_t kMaxFrame = 254;  // longest frame that COBS encodes unsplit
+
+uint16_t crc16(const uint8_t *data, size_t len);
+
+struct Frame {
+  uint8_t id;
+  uint8_t seq;
+  uint32_t millis;
+  const uint8_t *fields;  // valid only during the callback
+  size_t fields_len;
+};
+
+struct Stats {
+  Stats() : bytes(0), frames(0), crc_errors(0), framing_errors(0),
+            lost_frames(0), unknown_records(0), bad_records(0) {}
+  uint64_t bytes;
+  uint64_t frames;           // frames that passed the CRC
+  uint64_t crc_errors;
+  uint64_t framing_errors;   // bad COBS, too short or too long
+  uint64_t lost_frames;      // gaps in the sequence numbers
+  uint64_t unknown_records;  // data frames with no schema yet
+  uint64_t bad_records;      // data frames that don't match their schema
+};
+
+class FrameDecoder {
+ public:
+  typedef void (*Callback)(const Frame &frame, void *context);
+  FrameDecoder(Callback callback, void *context);
+  // Feeds raw bytes.  May be called with any chunking.
+  void feed(const uint8_t *data, size_t len);
+  const Stats &stats() const { return _stats; }
+  Stats &stats() { return _stats; }
+ private:
+  void finishFrame();
+  Callback _callback;
+  void *_context;
+  uint8_t _buf[kMaxFrame + 2];
+  size_t _len;
+  bool _overrun;
+  bool _have_seq;
+  uint8_t _last_seq;
+  Stats _stats;
+};
+
+enum FieldType { I8, U8, I16, U16, I32, U32, F32 };
+
+struct Field {
+  std::string name;
+  FieldType type;
+};
+
+class Schema {
+ public:
+  // Parses "name:type,name:type".  Returns false on a malformed descriptor.
+  bool parse(const std::string &descriptor);
+  size_t recordSize() const { return _size; }
+  const std::vector<Field> &fields() const { return _fields; }
+  const std::string &descriptor() const { return _descriptor; }
+ private:
+  std::vector<Field> _fields;
+  std::string _descriptor;
+  size_t _size;
+};
+
+// Column-oriented storage for one record type.  Every column holds one value
+// per record, with millis and seq as the first two columns.
+struct Table {
+  uint8_t id;
+  unsigned version;
+  Schema schema;
+  std::vector<uint32_t> millis;
+  std::vector<uint8_t> seq;
+  std::vector<std::vector<double> > columns;
+  size_t rows() const { return millis.size(); }
+};
+
+class Recorder {
+ public:
+  Recorder();
+  ~Recorder();
+  void feed(const uint8_t *data, size_t len) { _decoder.feed(data, len); }
+  const Stats &stats() const { return _decoder.stats(); }
+  const std::vector<Table *> &tables() const { return _tables; }
+  // Writes one CSV per table, named <prefix>_<id>.csv (or _<id>_v<n>.csv
+  // if a record id was redescribed with a different layout).
+  bool writeCsv(const std::string &prefix) const;
+ private:
+  static void onFrame(const Frame &frame, void *context);
+  void handleFrame(const Frame &frame);
+  FrameDecoder _decoder;
+  std::vector<Table *> _tables;
+  std::map<uint8_t, Table *> _current;
+};
+
+bool writeCsv(const Table &table, FILE *out);
+
+}  // namespace telemetry
+
+#endif
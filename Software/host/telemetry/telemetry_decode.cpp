@@ -0,0 +1,80 @@
+/*
+  telemetry_decode - Decodes captured BRAIN telemetry into CSV.
+
+  Usage: telemetry_decode [-o prefix] [capture ...]
+
+  Reads the captures in order (or stdin) as one stream and writes one CSV
+  per record type, <prefix>_<id>.csv, with millis and seq columns followed
+  by the fields named in the record's schema.  Stream statistics go to
+  stderr.
+*/
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static bool decodeFile(FILE *in, telemetry::Recorder &recorder) {
+  std::vector<uint8_t> buf(1 << 20);
+  size_t n;
+  while ((n = fread(&buf[0], 1, buf.size(), in)) > 0)
+    recorder.feed(&buf[0], n);
+  return !ferror(in);
+}
+
+static void usage() {
+  fprintf(stderr, "usage: telemetry_decode [-o prefix] [capture ...]\n");
+}
+
+int main(int argc, char **argv) {
+  std::string prefix = "telemetry";
+  std::vector<const char *> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      prefix = argv[++i];
+    } else if (argv[i][0] == '-' && argv[i][1]) {
+      usage();
+      return 2;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  telemetry::Recorder recorder;
+  if (inputs.empty())
+    inputs.push_back("-");
+  for (size_t i = 0; i < inputs.size(); i++) {
+    bool is_stdin = !strcmp(inputs[i], "-");
+    FILE *in = is_stdin ? stdin : fopen(inputs[i], "rb");
+    if (!in) {
+      perror(inputs[i]);
+      return 1;
+    }
+    bool ok = decodeFile(in, recorder);
+    if (!is_stdin)
+      fclose(in);
+    if (!ok) {
+      perror(inputs[i]);
+      return 1;
+    }
+  }
+
+  if (!recorder.writeCsv(prefix)) {
+    perror(prefix.c_str());
+    return 1;
+  }
+
+  const telemetry::Stats &s = recorder.stats();
+  fprintf(stderr, "%llu bytes, %llu frames, %llu crc errors, %llu framing errors, "
+          "%llu lost, %llu without schema, %llu malformed\n",
+          (unsigned long long) s.bytes, (unsigned long long) s.frames,
+          (unsigned long long) s.crc_errors, (unsigned long long) s.framing_errors,
+          (unsigned long long) s.lost_frames, (unsigned long long) s.unknown_records,
+          (unsigned long long) s.bad_records);
+  for (size_t i = 0; i < recorder.tables().size(); i++) {
+    const telemetry::Table &t = *recorder.tables()[i];
+    fprintf(stderr, "record %u v%u: %lu rows (%s)\n", t.id, t.version,
+            (unsigned long) t.rows(), t.schema.descriptor().c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,40 @@
+// Reads eight cell voltages in the background and sends them over CAN.
+//
+// AnalogScan converts the cells one after another from the ADC interrupt,
+// each averaged over 8 conversions, so a full set takes about 5.3 ms and
+// loop() never waits on the ADC.  Every 100 ms the latest set goes out as
+// two CAN frames.
+
+#define CELLS 8
+#define CELL_ID 0x620
+// 5 V reference across a 2:1 divider, in millivolts per count
+#define MV_PER_COUNT (5000.0 * 2 / 1024)
+
+const uint8_t cell_channels[CELLS] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+unsigned long last_send = 0;
+
+void setup() {
+  Can.begin(1000);
+  AnalogScan.begin(cell_channels, CELLS, 8);
+  AnalogScan.start();
+}
+
+void loop() {
+  if (millis() - last_send < 100 || !AnalogScan.available())
+    return;
+  last_send = millis();
+
+  unsigned int counts[CELLS];
+  AnalogScan.copy(counts);
+
+  // Four cells per frame, millivolts as little endian 16-bit values
+  for (uint8_t frame = 0; frame < 2; frame++) {
+    char data[8];
+    for (uint8_t i = 0; i < 4; i++) {
+      unsigned int mv = counts[frame * 4 + i] * MV_PER_COUNT;
+      data[2 * i] = mv & 0xFF;
+      data[2 * i + 1] = mv >> 8;
+    }
+    Can.send(CanMessage(CELL_ID + frame, data));
+  }
+}
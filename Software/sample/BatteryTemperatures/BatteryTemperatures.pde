@@ -0,0 +1,61 @@
+// Battery module temperatures from a string of DS18B20s.
+//
+// At start up the bus on pin 18 is searched for up to 16 sensors.  Then
+// every two seconds all of them convert at once and are read back one by
+// one.  Each temperature goes out over CAN as its own frame (sensor index,
+// then 1/16 degrees C), sent from loop() once the callback has it.  The
+// whole string is read in about 800 ms, nearly all of it the conversion,
+// with CAN and loop() running throughout.
+
+#define BUS_PIN 18
+#define MAX_SENSORS 16
+#define TEMP_ID 0x6A0
+#define PERIOD 2000
+
+uint8_t roms[MAX_SENSORS][8];
+volatile boolean searched = false;
+unsigned long last_read = 0;
+
+void searchDone(uint8_t status, void *) {
+  searched = true;
+}
+
+// From the interrupt, so just note the result for loop() to send
+volatile int temps[MAX_SENSORS];
+volatile unsigned int fresh = 0;
+
+void temperature(uint8_t index, int temp, uint8_t status) {
+  if (status != ONEWIRE_OK)
+    return;
+  temps[index] = temp;
+  fresh |= 1U << index;
+}
+
+void setup() {
+  Can.begin(1000);
+  OneWireBus.begin(BUS_PIN);
+  OneWireBus.search(roms, MAX_SENSORS, searchDone);
+}
+
+void loop() {
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    uint8_t oldSREG = SREG;
+    cli();
+    boolean send = (fresh >> i) & 1;
+    fresh &= ~(1U << i);
+    int temp = temps[i];
+    SREG = oldSREG;
+    if (send) {
+      char data[3];
+      data[0] = i;
+      data[1] = temp & 0xFF;
+      data[2] = temp >> 8;
+      Can.send(CanMessage(TEMP_ID, data, 3));
+    }
+  }
+
+  if (searched && millis() - last_read >= PERIOD) {
+    last_read += PERIOD;
+    OneWireBus.readTemperatures(roms, OneWireBus.found(), temperature);
+  }
+}
@@ -0,0 +1,45 @@
+// CanCallbackTest's status report sent as binary telemetry frames.
+// Capture the serial port to a file and decode it on the host with
+// Software/host/telemetry/telemetry_decode.
+
+#define MOTOR_RECORD 1
+
+float motor_velocity = 0;
+float motor_power = 0;
+unsigned long last_received = 0;
+unsigned long last_time = 0;
+
+Telemetry telemetry(Serial);
+
+typedef union {
+  char c[8];
+  float f[2];
+} two_floats;
+
+void process_packet(CanMessage &msg) {
+  if (msg.id == 0x501) {
+    last_received = millis();
+    two_floats data;
+    for (int i = 0; i < 8; i++) data.c[i] = msg.data[i];
+    motor_velocity = data.f[0];
+    motor_power = data.f[1];
+  }
+}
+
+void setup() {
+  Can.attach(&process_packet);
+  Can.begin(1000);
+  Serial.begin(115200);
+  telemetry.describe(MOTOR_RECORD, PSTR("last_seen:u32,velocity:f32,power:f32"));
+}
+
+void loop() {
+  if (millis() - last_time > 10) {
+    last_time = millis();
+    telemetry.begin(MOTOR_RECORD);
+    telemetry.add((uint32_t) last_received);
+    telemetry.add(motor_velocity);
+    telemetry.add(motor_power);
+    telemetry.send();
+  }
+}
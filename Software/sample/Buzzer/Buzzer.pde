@@ -0,0 +1,41 @@
+// Alert buzzer and sensor excitation from the timer compare outputs.
+//
+// The buzzer on pin 15 beeps 2.4 kHz in bursts while a warning is active,
+// and the conductivity probe on pin 13 is excited with 10 us pulses at
+// 1 kHz.  Both are made by the timers in hardware, so neither adds an
+// interrupt per edge alongside CAN.  A frame on ALERT_ID with a non-zero
+// first byte starts the warning, zero stops it.
+
+#define BUZZER_PIN 15
+#define PROBE_PIN 13
+#define ALERT_ID 0x680
+
+Waveform buzzer;
+Waveform probe;
+volatile int8_t alert = -1;
+
+void process_packet(CanMessage &message) {
+  if (message.id == ALERT_ID && message.len >= 1)
+    alert = message.data[0] != 0;
+}
+
+void setup() {
+  Can.begin(1000);
+  Can.attach(&process_packet);
+  buzzer.begin(BUZZER_PIN);
+  probe.begin(PROBE_PIN);
+  probe.pulses(1000, 10);
+  // Power on chirp
+  buzzer.square(2400, 50);
+}
+
+void loop() {
+  int8_t request = alert;
+  if (request < 0)
+    return;
+  alert = -1;
+  if (request)
+    buzzer.burst(2400, 100, 400);
+  else
+    buzzer.stop();
+}
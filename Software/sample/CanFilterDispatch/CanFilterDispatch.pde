@@ -0,0 +1,67 @@
+// Handles the four IDs this node cares about with one callback per
+// MCP2515 acceptance filter.
+//
+// The interrupt picks the callback from the number of the filter that
+// matched, which it reads along with the receive status, so no IDs are
+// compared in software.  Frames matched by a filter with no callback
+// (filter 3 here) go to the receive queue as usual.
+
+volatile unsigned int throttle = 0;
+volatile boolean brake = false;
+volatile unsigned long last_motor = 0;
+
+void onThrottle(CanMessage &msg) {
+  throttle = (uint8_t) msg.data[0] << 8 | (uint8_t) msg.data[1];
+}
+
+void onBrake(CanMessage &msg) {
+  brake = msg.data[0];
+}
+
+void onMotor(CanMessage &msg) {
+  last_motor = millis();
+}
+
+void setup() {
+  Serial.begin(115200);
+  Can.begin(1000);
+  Can.config(true);
+  Can.setMask(1, 0x7FF);
+  Can.setMask(2, 0x7FF);
+  Can.setFilter(1, 1, 0x200);   // RXF0
+  Can.setFilter(1, 2, 0x100);   // RXF1
+  Can.setFilter(2, 1, 0x501);   // RXF2
+  Can.setFilter(2, 2, 0x6A0);   // RXF3, queued
+  Can.setFilter(2, 3, 0x6A0);   // unused filters repeat one of the IDs
+  Can.setFilter(2, 4, 0x6A0);
+  Can.filterOn();
+  Can.config(false);
+  Can.attachFilter(0, onThrottle);
+  Can.attachFilter(1, onBrake);
+  Can.attachFilter(2, onMotor);
+  CanBufferInit();
+}
+
+void loop() {
+  CanMessage *msg;
+  while ((msg = CanBufferTake())) {
+    // ... handle the status request on 0x6A0 ...
+    CanBufferRelease(msg);
+  }
+
+  static unsigned long last_print = 0;
+  if (millis() - last_print >= 500) {
+    last_print = millis();
+    uint8_t oldSREG = SREG;
+    cli();
+    unsigned int t = throttle;
+    unsigned long m = last_motor;
+    SREG = oldSREG;
+    Serial.print(F("Throttle: "));
+    Serial.print(t);
+    Serial.print(brake ? F(" braking") : F(" "));
+    Serial.print(F(" motor seen "));
+    Serial.print(millis() - m);
+    Serial.println(F(" ms ago"));
+  }
+}
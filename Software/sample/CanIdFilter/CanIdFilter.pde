@@ -0,0 +1,41 @@
+// Receives a scattered set of CAN IDs, more than the MCP2515's six
+// filters can hold, with the software acceptance bitmap.
+//
+// The hardware filters are off, so the MCP2515 takes every frame, but the
+// receive interrupt drops anything not in the bitmap as soon as the ID has
+// been read.  Only the wanted frames use up the receive queue.
+
+unsigned char can_ids[CAN_ID_BITMAP_SIZE];
+unsigned long last_report = 0;
+unsigned int received = 0;
+
+void handleFrame(CanMessage &msg) {
+  received++;
+  // ... handle msg ...
+}
+
+void setup() {
+  Serial.begin(115200);
+  Can.begin(1000);
+  Can.filterOff();
+  Can.acceptFilter(can_ids);
+  Can.accept(0x100);           // brake
+  Can.accept(0x200);           // throttle
+  Can.accept(0x403, 0x40B);    // motor controller
+  Can.accept(0x501);           // motor velocity
+  Can.accept(0x600, 0x61F);    // battery modules
+  CanBufferInit();
+}
+
+void loop() {
+  CanBufferDrain(handleFrame);
+
+  if (millis() - last_report >= 1000) {
+    last_report += 1000;
+    Serial.print(F("Received: "));
+    Serial.print(received);
+    Serial.print(F(", filtered out: "));
+    Serial.println(Can.rejected());
+    received = 0;
+  }
+}
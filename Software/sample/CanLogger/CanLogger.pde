@@ -0,0 +1,39 @@
+// Prints every received CAN frame to the serial port, straight out of the
+// receive pool, and reports how full the pool has been once a second.
+//
+// The frame is only given back to the pool after it has been printed, so
+// a slow serial port shows up as a rising high water mark well before any
+// frames are dropped.
+
+unsigned long last_report = 0;
+
+void setup() {
+  Serial.begin(115200);
+  Can.begin(1000);
+  Can.filterOff();
+  CanBufferInit();
+}
+
+void loop() {
+  CanMessage *msg;
+  while ((msg = CanBufferTake())) {
+    Serial.print(msg->id, HEX);
+    for (uint8_t i = 0; i < msg->len; i++) {
+      Serial.print(' ');
+      Serial.print((uint8_t) msg->data[i], HEX);
+    }
+    Serial.println();
+    CanBufferRelease(msg);
+  }
+
+  if (millis() - last_report >= 1000) {
+    last_report += 1000;
+    Serial.print(F("Pool high water: "));
+    Serial.print(CanPoolHighWater());
+    Serial.print(F(" of "));
+    Serial.print(CAN_BUFFER_SIZE);
+    Serial.print(F(", dropped: "));
+    Serial.println(CanBufferOverruns());
+    CanPoolResetHighWater();
+  }
+}
@@ -0,0 +1,53 @@
+// Keeps the latest motor velocity and battery voltage frames in mailboxes
+// instead of queueing every one.
+//
+// Both are sent many times a second, faster than this loop needs them.
+// With mailboxes the loop always sees the newest value, however long it
+// has been busy, and bursts of them can't fill up the receive queue.
+// Everything else still goes through the queue.
+
+typedef union {
+  char c[8];
+  float f[2];
+} two_floats;
+
+CanMailbox motor(0x501);
+CanMailbox battery(0x600);
+unsigned long last_print = 0;
+
+void setup() {
+  Serial.begin(115200);
+  Can.begin(1000);
+  Can.subscribe(motor);
+  Can.subscribe(battery);
+  CanBufferInit();
+}
+
+void loop() {
+  CanBufferDrain(0);  // ... handle other frames ...
+
+  if (millis() - last_print < 500)
+    return;
+  last_print = millis();
+
+  if (motor.updated()) {
+    CanMessage msg;
+    unsigned long time;
+    two_floats data;
+    unsigned int seq = motor.read(msg, &time);
+    for (int i = 0; i < 8; i++) data.c[i] = msg.data[i];
+    Serial.print(F("Velocity: "));
+    Serial.print(data.f[0]);
+    Serial.print(F(" m/s, "));
+    Serial.print(millis() - time);
+    Serial.print(F(" ms old, frame "));
+    Serial.println(seq);
+  }
+  if (battery.updated()) {
+    CanMessage msg;
+    battery.read(msg);
+    Serial.print(F("Pack: "));
+    Serial.print(((uint8_t) msg.data[0] << 8 | (uint8_t) msg.data[1]) / 100.0);
+    Serial.println(F(" V"));
+  }
+}
@@ -0,0 +1,53 @@
+// Measures motor current in step with the PWM driving the motor.
+//
+// The motor is on pin 13 (Timer1, phase correct PWM) with a shunt
+// amplifier on analog 0.  AnalogScan triggers a conversion at every Timer1
+// overflow, the middle of the on-time, so each sample is the average
+// current rather than a point on the ripple.  The samples are filtered in
+// loop() and every 100 ms the current, the sample overruns and the timing
+// spread go out over CAN.
+
+#define MOTOR_PIN 13
+#define CURRENT_ID 0x630
+// 5 V reference, 50 mV/A shunt amplifier, in 10 mA steps per count.
+// Full scale is 100 A, which in milliamps would not fit in 16 bits.
+#define CENTIAMPS_PER_COUNT (500.0 / 1024 / 0.05)
+
+const uint8_t current_channel[] = { 0 };
+unsigned long filtered = 0;   // counts, scaled by 16
+unsigned long last_send = 0;
+
+void setup() {
+  Can.begin(1000);
+  analogWrite(MOTOR_PIN, 100);
+  AnalogScan.begin(current_channel, 1);
+  AnalogScan.syncToPwm(MOTOR_PIN);
+  AnalogScan.start();
+}
+
+void loop() {
+  unsigned int counts;
+  // First order low pass over the per-period samples, time constant 16
+  while (AnalogScan.readSample(&counts))
+    filtered += counts - (filtered >> 4);
+
+  if (millis() - last_send < 100)
+    return;
+  last_send = millis();
+
+  unsigned int centiamps = (filtered >> 4) * CENTIAMPS_PER_COUNT;
+  unsigned int overruns = AnalogScan.sampleOverruns();
+  unsigned int jitter = AnalogScan.jitter();
+  // Little endian 16-bit values
+  char data[8];
+  data[0] = centiamps & 0xFF;
+  data[1] = centiamps >> 8;
+  data[2] = overruns & 0xFF;
+  data[3] = overruns >> 8;
+  data[4] = jitter & 0xFF;
+  data[5] = jitter >> 8;
+  data[6] = 0;
+  data[7] = 0;
+  Can.send(CanMessage(CURRENT_ID, data));
+  AnalogScan.resetJitter();
+}
@@ -0,0 +1,42 @@
+// Drives a 4-wire PC fan from CAN with 25 kHz PWM.
+//
+// Fans want 21-28 kHz on their PWM input, far above the 610 Hz analogWrite()
+// gives.  pwm16Begin() runs Timer1 at 25 kHz, which at 20 MHz leaves 401
+// duty steps.  A frame on FAN_ID sets the speed as a 16-bit fraction of full
+// scale, and the fan ramps to it one step per millisecond so it isn't
+// slammed from stop to full.
+
+#define FAN_PIN 13
+#define FAN_ID 0x640
+
+volatile unsigned int target = 0;
+unsigned int duty = 0;
+unsigned long last_step = 0;
+
+void process_packet(CanMessage &message) {
+  if (message.id == FAN_ID && message.len >= 2)
+    target = pwm16Scale((uint8_t) message.data[0] | ((uint8_t) message.data[1] << 8));
+}
+
+void setup() {
+  Can.begin(1000);
+  Can.attach(&process_packet);
+  pwm16Begin(25000, PWM_CENTER);
+  pwm16Connect(FAN_PIN);
+}
+
+void loop() {
+  if (millis() == last_step)
+    return;
+  last_step = millis();
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int want = target;
+  SREG = oldSREG;
+  if (duty < want)
+    duty++;
+  else if (duty > want)
+    duty--;
+  // Pin 13 is OC1A
+  pwm16WriteA(duty);
+}
@@ -0,0 +1,57 @@
+// Cycle counts for digitalWrite()/digitalRead() against the compile time
+// versions in FastPin.h, on pin 13.
+//
+// Each figure is the Timer1 count around one call with the cost of an
+// empty measurement taken off.  The fast versions should come out at 2
+// cycles (sbi/cbi, or the out for a toggle), plus a cycle or two for the
+// read to land in a register.
+
+// Runs stmt once with Timer1 counting raw cycles and returns the count.
+// Interrupts are held off so the millis() tick doesn't land in the count,
+// and Timer1 is put back the way init() left it afterwards.
+#define CYCLES(stmt) ({ \
+  uint8_t s = SREG, a = TCCR1A, b = TCCR1B; \
+  cli(); \
+  TCCR1A = 0; TCCR1B = 0; TCNT1 = 0; \
+  TCCR1B = _BV(CS10); \
+  stmt; \
+  uint16_t c = TCNT1; \
+  TCCR1B = b; TCCR1A = a; \
+  SREG = s; \
+  c; })
+
+#define TEST_PIN 13
+
+volatile uint8_t sink;
+uint8_t runtime_pin = TEST_PIN;
+FastPin<TEST_PIN> pin;
+
+void report(const char *name, uint16_t cycles, uint16_t empty) {
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print((unsigned int) (cycles - empty));
+  Serial.println(" cycles");
+}
+
+void setup() {
+  Serial.begin(115200);
+  pinMode(TEST_PIN, OUTPUT);
+  Serial.println("Digital I/O benchmark begin");
+}
+
+void loop() {
+  uint16_t empty = CYCLES(;);
+
+  report("digitalWrite(13, HIGH)", CYCLES(digitalWrite(TEST_PIN, HIGH)), empty);
+  report("digitalWriteFast(13, HIGH)", CYCLES(digitalWriteFast(TEST_PIN, HIGH)), empty);
+  report("FastPin<13>::high()", CYCLES(pin.high()), empty);
+  report("digitalWriteFast(runtime pin, LOW)",
+      CYCLES(digitalWriteFast(runtime_pin, LOW)), empty);
+  report("digitalRead(13)", CYCLES(sink = digitalRead(TEST_PIN)), empty);
+  report("digitalReadFast(13)", CYCLES(sink = digitalReadFast(TEST_PIN)), empty);
+  report("digitalWrite(13, !digitalRead(13))",
+      CYCLES(digitalWrite(TEST_PIN, !digitalRead(TEST_PIN))), empty);
+  report("digitalToggleFast(13)", CYCLES(digitalToggleFast(TEST_PIN)), empty);
+
+  delay(5000);
+}
@@ -0,0 +1,67 @@
+// Reads an I2C temperature sensor and current monitor in the background.
+//
+// A TMP102 (0x48) and an INA219 (0x40) share the bus at 400 kHz.  Every
+// 50 ms both are read with write-then-read transactions; the driver runs
+// them from the TWI interrupt while loop() is free, and the callbacks send
+// each result over CAN as it arrives.  Failures are counted and reported
+// once a second.
+
+#define TMP102 0x48
+#define INA219 0x40
+#define TEMP_ID 0x690
+#define CURRENT_ID 0x691
+#define STATUS_ID 0x692
+
+const uint8_t temp_reg = 0x00;
+const uint8_t current_reg = 0x04;
+uint8_t temp[2];
+uint8_t current[2];
+TwiTransaction read_temp;
+TwiTransaction read_current;
+volatile boolean temp_ready = false;
+volatile boolean current_ready = false;
+unsigned long last_read = 0;
+unsigned long last_status = 0;
+
+void gotTemp(uint8_t status, void *) {
+  temp_ready = status == TWI_OK;
+}
+
+void gotCurrent(uint8_t status, void *) {
+  current_ready = status == TWI_OK;
+}
+
+void setup() {
+  Can.begin(1000);
+  Twi.begin(400000);
+}
+
+void loop() {
+  if (millis() - last_read >= 50) {
+    last_read += 50;
+    // Refused while the last read is still going, which is fine
+    Twi.writeRead(read_temp, TMP102, &temp_reg, 1, temp, 2, gotTemp);
+    Twi.writeRead(read_current, INA219, &current_reg, 1, current, 2, gotCurrent);
+  }
+
+  if (temp_ready) {
+    temp_ready = false;
+    Can.send(CanMessage(TEMP_ID, (char *) temp, 2));
+  }
+  if (current_ready) {
+    current_ready = false;
+    Can.send(CanMessage(CURRENT_ID, (char *) current, 2));
+  }
+
+  if (millis() - last_status >= 1000) {
+    last_status += 1000;
+    unsigned int errors = Twi.errors();
+    unsigned int timeouts = Twi.timeouts();
+    char data[4];
+    data[0] = errors & 0xFF;
+    data[1] = errors >> 8;
+    data[2] = timeouts & 0xFF;
+    data[3] = timeouts >> 8;
+    Can.send(CanMessage(STATUS_ID, data, 4));
+  }
+}
@@ -0,0 +1,53 @@
+// Battery powered auxiliary node: sends a status frame every two seconds
+// and sleeps the rest of the time, with the MCP2515 asleep as well.
+//
+// Bus traffic wakes both chips early through the CAN wake up interrupt.
+// After waking the node stays up, sleeping only in idle(), until the bus
+// has been quiet for a second, so it can answer requests.  Every status
+// frame carries the idle percentage since the last one.
+
+#define STATUS_ID 0x6A0
+#define STATUS_PERIOD 2000
+#define AWAKE_TIME 1000
+
+unsigned long last_status = 0;
+unsigned long last_traffic = 0;
+
+void sendStatus() {
+  char data[2];
+  data[0] = idlePercent();
+  data[1] = CanBufferOverruns();
+  Can.send(CanMessage(STATUS_ID, data, 2));
+  last_status = millis();
+}
+
+void handleFrame(CanMessage &msg) {
+  // ... handle msg ...
+}
+
+void setup() {
+  Can.begin(1000);
+  CanBufferInit();
+}
+
+void loop() {
+  if (CanBufferDrain(handleFrame))
+    last_traffic = millis();
+
+  if (millis() - last_status >= STATUS_PERIOD)
+    sendStatus();
+
+  if (millis() - last_traffic < AWAKE_TIME) {
+    // Recent traffic: stay responsive, just stop the cpu until the next
+    // interrupt
+    idle();
+    return;
+  }
+
+  Can.sleep();
+  unsigned long wait = STATUS_PERIOD - (millis() - last_status);
+  // powerSave() only stops short by more than 16 ms if something woke it
+  if (powerSave(wait) + 16 <= wait)
+    last_traffic = millis();
+  Can.wake();
+}
@@ -0,0 +1,38 @@
+// Motor drive with a hardware overcurrent trip.
+//
+// The shunt amplifier on analog 0 gives 1.1 V at the current limit, so the
+// comparator against the bandgap trips the moment the limit is passed and
+// the PWM on pin 13 is cut from the interrupt.  loop() reports the fault
+// over CAN, and a frame on RESET_ID re-arms the drive once the current has
+// come back down.
+
+#define MOTOR_PIN 13
+#define SENSE_CHANNEL 0
+#define FAULT_ID 0x670
+#define RESET_ID 0x671
+
+volatile boolean reset_requested = false;
+uint8_t speed = 128;
+
+void process_packet(CanMessage &message) {
+  if (message.id == RESET_ID)
+    reset_requested = true;
+}
+
+void setup() {
+  Can.begin(1000);
+  Can.attach(&process_packet);
+  Fault.begin(SENSE_CHANNEL, FAULT_REF_BANDGAP);
+  analogWrite(MOTOR_PIN, speed);
+}
+
+void loop() {
+  Fault.report(FAULT_ID);
+
+  if (reset_requested) {
+    reset_requested = false;
+    // Refused while still over the limit; try again on the next request
+    if (Fault.tripped() && Fault.clear() == 0)
+      analogWrite(MOTOR_PIN, speed);
+  }
+}
@@ -0,0 +1,52 @@
+// Wheel speed and a switch on pin change interrupts, alongside CAN.
+//
+// The wheel sensor is on pin 0 (PB0), the same port as the MCP2515 INT
+// pin, so both share PCINT1; the pin change service sorts out which one
+// moved.  The brake switch on pin 20 (PC4) uses PCINT2.
+
+#define WHEEL_PIN 0
+#define BRAKE_PIN 20
+#define PULSES_PER_REV 12
+
+volatile unsigned int wheel_pulses = 0;
+volatile boolean brake_changed = false;
+unsigned long last_report = 0;
+
+void wheelPulse() {
+  wheel_pulses++;
+}
+
+void brakeChanged() {
+  brake_changed = true;
+}
+
+void setup() {
+  Serial.begin(115200);
+  Can.begin(1000);
+  CanBufferInit();
+  pinMode(WHEEL_PIN, INPUT);
+  pinMode(BRAKE_PIN, INPUT);
+  digitalWrite(BRAKE_PIN, HIGH);  // pull up
+  attachPinChangeInterrupt(WHEEL_PIN, wheelPulse, RISING);
+  attachPinChangeInterrupt(BRAKE_PIN, brakeChanged, CHANGE);
+}
+
+void loop() {
+  if (brake_changed) {
+    brake_changed = false;
+    Serial.println(digitalRead(BRAKE_PIN) ? F("Brake off") : F("Brake on"));
+  }
+
+  if (millis() - last_report >= 1000) {
+    last_report += 1000;
+    uint8_t oldSREG = SREG;
+    cli();
+    unsigned int pulses = wheel_pulses;
+    wheel_pulses = 0;
+    SREG = oldSREG;
+    Serial.print(F("Wheel: "));
+    Serial.print(pulses * 60 / PULSES_PER_REV);
+    Serial.print(F(" rpm, CAN frames waiting: "));
+    Serial.println(CanBufferSize());
+  }
+}
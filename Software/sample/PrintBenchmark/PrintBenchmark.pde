@@ -0,0 +1,155 @@
+// Measures how fast Print can format a line of telemetry.
+//
+// ByteSink only overrides write(uint8_t), so every character goes through a
+// virtual call, the same as before Print had a bulk write.  BufferSink also
+// overrides write(const uint8_t *, size_t), which is the path print() and
+// println() now use.  Both throw the output away so only the formatting and
+// dispatch cost is measured.  The Serial runs show the cost with the UART:
+// SerialBytes hands Serial one character at a time, the way every print()
+// reached the UART before the bulk write, against Serial itself.  Each pair
+// is printed as before and after.  Writes wait for the UART, so at 115200
+// baud both Serial runs are held to the line rate; the difference shows at
+// 1 Mbaud and up.
+//
+// The second half counts CPU cycles for single number prints with Timer1
+// briefly switched to clk/1, comparing against a copy of the old
+// divide-per-digit printNumber.
+
+class ByteSink : public Print {
+  public:
+    unsigned long count;
+    ByteSink() : count(0) {}
+    virtual void write(uint8_t b) { count++; }
+};
+
+class BufferSink : public Print {
+  public:
+    unsigned long count;
+    BufferSink() : count(0) {}
+    virtual void write(uint8_t b) { count++; }
+    virtual void write(const uint8_t *buffer, size_t size) { count += size; }
+};
+
+// The per-character path into the UART, as it was before the bulk write
+class SerialBytes : public Print {
+  public:
+    virtual void write(uint8_t b) { Serial.write(b); }
+};
+
+#define LINES 200
+#define SERIAL_LINES 20
+
+// The printNumber() Print used to have: a 32-bit % and / per digit, then
+// one virtual write per character.
+void legacyPrintNumber(Print &out, unsigned long n, uint8_t base) {
+  unsigned char buf[8 * sizeof(long)];
+  unsigned long i = 0;
+  if (n == 0) {
+    out.print('0');
+    return;
+  }
+  while (n > 0) {
+    buf[i++] = n % base;
+    n /= base;
+  }
+  for (; i > 0; i--)
+    out.print((char) (buf[i - 1] < 10 ? '0' + buf[i - 1] : 'A' + buf[i - 1] - 10));
+}
+
+// Runs stmt once with Timer1 counting raw cycles and returns the count.
+// Interrupts are held off so the millis() tick doesn't land in the count,
+// and Timer1 is put back the way init() left it afterwards.
+#define CYCLES(stmt) ({ \
+  uint8_t s = SREG, a = TCCR1A, b = TCCR1B; \
+  cli(); \
+  TCCR1A = 0; TCCR1B = 0; TCNT1 = 0; \
+  TCCR1B = _BV(CS10); \
+  stmt; \
+  uint16_t c = TCNT1; \
+  TCCR1B = b; TCCR1A = a; \
+  SREG = s; \
+  c; })
+
+void reportCycles(const char *name, uint16_t legacy, uint16_t current) {
+  Serial.print(name);
+  Serial.print(": legacy ");
+  Serial.print((unsigned int) legacy);
+  Serial.print(" cycles, current ");
+  Serial.print((unsigned int) current);
+  Serial.println(" cycles");
+}
+
+void telemetryLine(Print &out, long i) {
+  out.print("node,");
+  out.print(i);
+  out.print(",velocity,");
+  out.print(12.34);
+  out.print(",power,");
+  out.print(567.0);
+  out.println(",ok");
+}
+
+void report(const char *name, unsigned long chars, unsigned long ms) {
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(chars);
+  Serial.print(" chars in ");
+  Serial.print(ms);
+  Serial.print(" ms = ");
+  Serial.print(ms ? chars * 1000 / ms : 0);
+  Serial.println(" chars/s");
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println("Print benchmark begin");
+}
+
+void loop() {
+  unsigned long start;
+  ByteSink bytes;
+  BufferSink buffers;
+
+  start = millis();
+  for (long i = 0; i < LINES; i++)
+    telemetryLine(bytes, i);
+  report("per-byte sink (before)", bytes.count, millis() - start);
+
+  start = millis();
+  for (long i = 0; i < LINES; i++)
+    telemetryLine(buffers, i);
+  report("bulk sink (after)", buffers.count, millis() - start);
+
+  // The Serial lines have fewer digits than the 200 above, so count them
+  // on their own, untimed
+  BufferSink serial_chars;
+  for (long i = 0; i < SERIAL_LINES; i++)
+    telemetryLine(serial_chars, i);
+
+  SerialBytes serial_bytes;
+  start = millis();
+  for (long i = 0; i < SERIAL_LINES; i++)
+    telemetryLine(serial_bytes, i);
+  report("Serial per-byte (before)", serial_chars.count, millis() - start);
+
+  start = millis();
+  for (long i = 0; i < SERIAL_LINES; i++)
+    telemetryLine(Serial, i);
+  report("Serial bulk (after)", serial_chars.count, millis() - start);
+
+  BufferSink sink;
+  reportCycles("print(1234567890UL)",
+      CYCLES(legacyPrintNumber(sink, 1234567890UL, 10)),
+      CYCLES(sink.print(1234567890UL)));
+  reportCycles("print(0xBEEF, HEX)",
+      CYCLES(legacyPrintNumber(sink, 0xBEEF, 16)),
+      CYCLES(sink.print(0xBEEFL, HEX)));
+  reportCycles("print(-12.34) vs print(Fixed(-3159, 8))",
+      CYCLES(sink.print(-12.34)),
+      CYCLES(sink.print(Fixed(-3159, 8))));
+  reportCycles("print(-12.34) vs print(Decimal(-1234, 2))",
+      CYCLES(sink.print(-12.34)),
+      CYCLES(sink.print(Decimal(-1234, 2))));
+
+  delay(5000);
+}
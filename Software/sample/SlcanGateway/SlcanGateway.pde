@@ -0,0 +1,17 @@
+// Turns the BRAIN into an SLCAN (Lawicel) USB-to-CAN interface.
+// On Linux:
+//   slcand -o -s8 -S 250000 /dev/ttyUSB0 can0
+//   ip link set up can0
+//   candump can0
+// 250000 baud divides exactly from 20 MHz; 1250000 is the next step up
+// if the USB serial adapter supports it.
+
+SlcanGateway gateway(Serial);
+
+void setup() {
+  gateway.begin(250000);
+}
+
+void loop() {
+  gateway.poll();
+}
@@ -0,0 +1,64 @@
+// CanCallbackTest done with software timers instead of millis() checks.
+//
+// The status report is a periodic deferred timer, so it runs from
+// Timers.poll() in loop() where it is safe to print.  The CAN timeout is a
+// one-shot timer restarted by every drive packet; its callback runs in the
+// timer interrupt and only sets a flag.  The LED blinks from the interrupt
+// too, so it keeps time however long loop() takes.
+
+float motor_velocity = 0;
+float motor_power = 0;
+volatile boolean timed_out = true;
+
+Timer report_timer;
+Timer timeout_timer;
+Timer blink_timer;
+
+typedef union {
+  char c[8];
+  float f[2];
+} two_floats;
+
+void timeout(void *) {
+  timed_out = true;
+}
+
+void blink(void *) {
+  digitalWrite(13, !digitalRead(13));
+}
+
+void report(void *) {
+  if (timed_out)
+    Serial.print(F("No drive command in the last 250 ms"));
+  else
+    Serial.print(F("Receiving"));
+  Serial.print(F("\tVelocity: "));
+  Serial.print(motor_velocity);
+  Serial.print(F("m/s\tPower: "));
+  Serial.print(motor_power);
+  Serial.println(F("%"));
+}
+
+void process_packet(CanMessage &msg) {
+  if (msg.id == 0x501) {
+    two_floats data;
+    for (int i = 0; i < 8; i++) data.c[i] = msg.data[i];
+    motor_velocity = data.f[0];
+    motor_power = data.f[1];
+    timed_out = false;
+    Timers.start(timeout_timer, 250, timeout);
+  }
+}
+
+void setup() {
+  pinMode(13, OUTPUT);
+  Can.attach(&process_packet);
+  Can.begin(1000);
+  Serial.begin(115200);
+  Timers.start(report_timer, 500, report, 0, TIMER_PERIODIC | TIMER_DEFERRED);
+  Timers.start(blink_timer, 100, blink, 0, TIMER_PERIODIC);
+}
+
+void loop() {
+  Timers.poll();
+}
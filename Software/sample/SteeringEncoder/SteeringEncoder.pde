@@ -0,0 +1,52 @@
+// Steering angle from a quadrature encoder, sent over CAN.
+//
+// A 256 line encoder on pins 16 and 17 (PC0, PC1) gives 1024 counts a
+// turn.  The decoder runs entirely from pin change interrupts, so loop()
+// only reads the result: every 20 ms the position, velocity and error
+// count go out in one frame.  A frame on ZERO_ID with the wheels straight
+// sets the current position as zero.
+
+#define ENCODER_A 16
+#define ENCODER_B 17
+#define ANGLE_ID 0x660
+#define ZERO_ID 0x661
+
+QuadratureEncoder steering;
+volatile boolean zero_requested = false;
+unsigned long last_report = 0;
+
+void process_packet(CanMessage &message) {
+  if (message.id == ZERO_ID)
+    zero_requested = true;
+}
+
+void setup() {
+  Can.begin(1000);
+  Can.attach(&process_packet);
+  steering.begin(ENCODER_A, ENCODER_B);
+}
+
+void loop() {
+  if (zero_requested) {
+    zero_requested = false;
+    steering.write(0);
+  }
+
+  if (millis() - last_report < 20)
+    return;
+  last_report += 20;
+
+  long position = steering.position();
+  long velocity = steering.velocity();
+  unsigned int errors = steering.errors();
+  char data[8];
+  data[0] = position & 0xFF;
+  data[1] = (position >> 8) & 0xFF;
+  data[2] = (position >> 16) & 0xFF;
+  data[3] = (position >> 24) & 0xFF;
+  data[4] = velocity & 0xFF;
+  data[5] = (velocity >> 8) & 0xFF;
+  data[6] = errors & 0xFF;
+  data[7] = errors >> 8;
+  Can.send(CanMessage(ANGLE_ID, data));
+}
@@ -0,0 +1,84 @@
+// Control, CAN handling and reporting as scheduler tasks.
+//
+// The control step runs every 10 ms at the highest priority.  Received
+// drive commands are posted from the CAN callback to a second task, and
+// the once a second report, which spends milliseconds in Serial.print, is
+// the least urgent, so it can only hold the control step up by one call.
+// The report prints each task's worst case time and overruns.
+
+float motor_velocity = 0;
+float motor_power = 0;
+float output = 0;
+
+void controlStep(unsigned int event);
+void driveCommand(unsigned int event);
+void report(unsigned int event);
+
+Task control(controlStep, 0);
+Task drive(driveCommand, 1);
+Task reporter(report, 3);
+
+typedef union {
+  char c[8];
+  float f[2];
+} two_floats;
+
+void controlStep(unsigned int event) {
+  output += (motor_velocity - output) * 0.1;
+}
+
+// Latest drive frame, filled in by the CAN interrupt
+two_floats drive_frame;
+
+void driveCommand(unsigned int event) {
+  two_floats data;
+  uint8_t oldSREG = SREG;
+  cli();
+  data = drive_frame;
+  SREG = oldSREG;
+  motor_velocity = data.f[0];
+  motor_power = data.f[1];
+}
+
+void printTask(const __FlashStringHelper *name, Task &task) {
+  Serial.print(name);
+  Serial.print(F(" runs "));
+  Serial.print(task.runs());
+  Serial.print(F(" max "));
+  Serial.print(ticksToMicroseconds(task.maxTicks()));
+  Serial.print(F(" us overruns "));
+  Serial.println(task.overruns());
+}
+
+void report(unsigned int event) {
+  Serial.print(F("Velocity: "));
+  Serial.print(motor_velocity);
+  Serial.print(F("m/s\tOutput: "));
+  Serial.println(output);
+  printTask(F("control"), control);
+  printTask(F("drive"), drive);
+  printTask(F("report"), reporter);
+}
+
+// Called from the CAN interrupt for each frame
+void frameReceived(CanMessage &msg) {
+  if (msg.id == 0x501) {
+    for (int i = 0; i < 8; i++) drive_frame.c[i] = msg.data[i];
+    Scheduler.post(drive);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  Can.attach(&frameReceived);
+  Can.begin(1000);
+  Scheduler.add(control);
+  Scheduler.add(drive);
+  Scheduler.add(reporter);
+  Scheduler.every(control, 10);
+  Scheduler.every(reporter, 1000);
+}
+
+void loop() {
+  Scheduler.run();
+}
@@ -0,0 +1,38 @@
+// Wheel speed from a hall sensor on the input capture pin.
+//
+// The sensor gives PULSES_PER_REV pulses a turn on pin 14 (ICP1).  Capture
+// times every rising edge in hardware, so the speed comes from the mean of
+// the last eight periods with no polling or pulseIn() waits.  Ten times a
+// second the speed and the sensor duty go out over CAN; if no edge has
+// come for half a second the wheel is taken to be stopped.
+
+#define PULSES_PER_REV 12
+#define WHEEL_ID 0x650
+// 0.4 us ticks at 20 MHz, so 500 ms is 1250000 ticks
+#define STOPPED_TICKS (F_CPU / 8 / 2)
+
+unsigned long last_report = 0;
+
+void setup() {
+  Can.begin(1000);
+  Capture.begin(8, CAPTURE_BOTH, true);
+}
+
+void loop() {
+  if (millis() - last_report < 100)
+    return;
+  last_report += 100;
+
+  unsigned int rpm = 0;
+  unsigned long us = Capture.ticksToMicros(Capture.averagePeriod());
+  if (us && Capture.sinceEdge() < STOPPED_TICKS)
+    rpm = 60000000UL / PULSES_PER_REV / us;
+  unsigned int duty = Capture.duty();
+
+  char data[4];
+  data[0] = rpm & 0xFF;
+  data[1] = rpm >> 8;
+  data[2] = duty & 0xFF;
+  data[3] = duty >> 8;
+  Can.send(CanMessage(WHEEL_ID, data, 4));
+}